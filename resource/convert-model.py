@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+# Converts the saved model of Basic Pitch to a TensorFlow Lite model with
+# reduced precision weights: float16 weights or dynamic range int8 weights
+# (the activations remain in float32 so no representative dataset is needed).
+#
+# Usage: convert-model.py --precision fp16|int8 saved_model_dir output.tflite
+
+import argparse
+import sys
+
+import tensorflow as tf
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Converts the Basic Pitch saved model to a reduced precision TensorFlow Lite model")
+    parser.add_argument("--precision", choices=["fp16", "int8"], required=True)
+    parser.add_argument("saved_model")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    converter = tf.lite.TFLiteConverter.from_saved_model(args.saved_model)
+    converter.optimizations = [tf.lite.Optimize.DEFAULT]
+    if args.precision == "fp16":
+        converter.target_spec.supported_types = [tf.float16]
+    model = converter.convert()
+    with open(args.output, "wb") as file:
+        file.write(model)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
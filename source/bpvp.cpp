@@ -1,7 +1,19 @@
 #include "bpvp.h"
 #include "bpvp_convert.h"
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numbers>
+#include <numeric>
+#include <tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h>
 #include <vamp-sdk/PluginAdapter.h>
 
 #if defined(_MSC_VER)
@@ -55,6 +67,267 @@
 
 #endif
 
+namespace
+{
+    auto constexpr decoderLookbackFrames = static_cast<size_t>(Bpvp::modelNumFrames * 3);
+    auto constexpr maxNumChannels = static_cast<size_t>(64);
+    auto constexpr minSilenceThreshold = -120.0f;
+    auto constexpr silencePeakMargin = 20.0f;
+    auto constexpr frameDuration = 1000.0 * static_cast<double>(Bpvp::modelFFTHope) / static_cast<double>(Bpvp::modelSampleRate);
+    auto constexpr minLiveHop = 10.0f;
+    auto constexpr maxLiveHop = 1000.0f;
+    auto constexpr minLatencyBudget = 10.0f;
+    auto constexpr maxLatencyBudget = 2000.0f;
+
+    // The threshold presets are decoded as additional note outputs from the
+    // same activations as the main note output
+    struct ThresholdPreset
+    {
+        char const* identifier;
+        char const* name;
+        float frameThreshold;
+        float onsetThreshold;
+        int minNoteDuration;
+    };
+
+    std::array<ThresholdPreset, 3> constexpr thresholdPresets{{{"pitchconservative", "Conservative", 0.8f, 0.7f, 200},
+                                                               {"pitchbalanced", "Balanced", 0.7f, 0.5f, 120},
+                                                               {"pitchsensitive", "Sensitive", 0.5f, 0.3f, 60}}};
+
+    // The null activations of the windows that are not analysed
+    float const* getSilentOutput()
+    {
+        static std::vector<float> const silence(Bpvp::modelContourTensorSize, 0.0f);
+        return silence.data();
+    }
+
+    // Copies samples from a ring buffer, the copy wraps around its end
+    void readRingBuffer(std::vector<float> const& ringBuffer, size_t position, size_t numSamples, float* output)
+    {
+        auto const numFirstSamples = std::min(numSamples, ringBuffer.size() - position);
+        auto const begin = std::next(ringBuffer.cbegin(), static_cast<long>(position));
+        std::copy(begin, std::next(begin, static_cast<long>(numFirstSamples)), output);
+        std::copy(ringBuffer.cbegin(), std::next(ringBuffer.cbegin(), static_cast<long>(numSamples - numFirstSamples)), output + numFirstSamples);
+    }
+
+    void clearRingBuffer(std::vector<float>& ringBuffer, size_t position, size_t numSamples)
+    {
+        auto const numFirstSamples = std::min(numSamples, ringBuffer.size() - position);
+        auto const begin = std::next(ringBuffer.begin(), static_cast<long>(position));
+        std::fill(begin, std::next(begin, static_cast<long>(numFirstSamples)), 0.0f);
+        std::fill(ringBuffer.begin(), std::next(ringBuffer.begin(), static_cast<long>(numSamples - numFirstSamples)), 0.0f);
+    }
+
+    std::optional<std::string> getEnvironmentVariable(char const* name)
+    {
+#if defined(_MSC_VER)
+        char* buffer = nullptr;
+        size_t size = 0;
+        if(_dupenv_s(&buffer, &size, name) != 0 || buffer == nullptr)
+        {
+            return {};
+        }
+        std::string value(buffer);
+        free(buffer);
+        return value;
+#else
+        auto const* value = std::getenv(name);
+        if(value == nullptr)
+        {
+            return {};
+        }
+        return std::string(value);
+#endif
+    }
+
+    // The threads of the inferences of all the instances are limited to a
+    // budget defined by BPVP_THREAD_BUDGET or by the number of cores
+    Bpvp::Scheduler& getScheduler()
+    {
+        static Bpvp::Scheduler scheduler([]()
+                                         {
+                                             if(auto const budget = getEnvironmentVariable("BPVP_THREAD_BUDGET"); budget.has_value() && std::atoi(budget.value().c_str()) > 0)
+                                             {
+                                                 return static_cast<size_t>(std::atoi(budget.value().c_str()));
+                                             }
+                                             return std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+                                         }());
+        return scheduler;
+    }
+
+    // The models are only read by the interpreters so a single instance of
+    // each variant is shared by all the plugins of the process, it is
+    // released with the last plugin
+    std::shared_ptr<TfLiteModel> getSharedModel(void const* data, size_t size)
+    {
+        static std::mutex mutex;
+        static std::map<void const*, std::weak_ptr<TfLiteModel>> sharedModels;
+        std::scoped_lock lock(mutex);
+        auto& sharedModel = sharedModels[data];
+        if(auto model = sharedModel.lock())
+        {
+            return model;
+        }
+        auto* model = TfLiteModelCreate(data, size);
+        if(model == nullptr)
+        {
+            return nullptr;
+        }
+        auto result = std::shared_ptr<TfLiteModel>(model, [](TfLiteModel* m)
+                                                   {
+                                                       TfLiteModelDelete(m);
+                                                   });
+        sharedModel = result;
+        return result;
+    }
+
+    // The external models are memory mapped so all the processes share the
+    // same copy of the file in the page cache, the file is unmapped with the
+    // model
+    std::shared_ptr<TfLiteModel> getSharedModel(std::filesystem::path const& path, void const*& data, size_t& size)
+    {
+        static std::mutex mutex;
+        static std::map<std::filesystem::path, std::pair<std::weak_ptr<TfLiteModel>, std::shared_ptr<Bpvp::MappedFile>>> sharedModels;
+        std::scoped_lock lock(mutex);
+        auto& sharedModel = sharedModels[path];
+        if(auto model = sharedModel.first.lock())
+        {
+            data = sharedModel.second->data();
+            size = sharedModel.second->size();
+            return model;
+        }
+        auto file = std::make_shared<Bpvp::MappedFile>();
+        if(!file->open(path))
+        {
+            return nullptr;
+        }
+        auto* model = TfLiteModelCreate(file->data(), file->size());
+        if(model == nullptr)
+        {
+            return nullptr;
+        }
+        auto result = std::shared_ptr<TfLiteModel>(model, [file](TfLiteModel* m)
+                                                   {
+                                                       TfLiteModelDelete(m);
+                                                   });
+        data = file->data();
+        size = file->size();
+        sharedModel = std::make_pair(result, file);
+        return result;
+    }
+
+    // The XNNPACK delegates pack the weights of the model for their kernels,
+    // the packed weights are shared by all the interpreters of the process
+    // that use the same model and the same kernels. The cache is finalised
+    // once the first interpreter is created so the next interpreters only
+    // look up the packed weights.
+    struct WeightsCache
+    {
+        WeightsCache() = default;
+        WeightsCache(WeightsCache const&) = delete;
+        WeightsCache& operator=(WeightsCache const&) = delete;
+        ~WeightsCache()
+        {
+            if(cache != nullptr)
+            {
+                TfLiteXNNPackDelegateWeightsCacheDelete(cache);
+            }
+        }
+
+        std::mutex mutex;
+        TfLiteXNNPackDelegateWeightsCache* cache{nullptr};
+        bool isFinalised{false};
+    };
+
+    std::shared_ptr<WeightsCache> getSharedWeightsCache(TfLiteModel const* model, bool isFp16)
+    {
+        static std::mutex mutex;
+        static std::map<std::pair<TfLiteModel const*, bool>, std::weak_ptr<WeightsCache>> sharedCaches;
+        std::scoped_lock lock(mutex);
+        auto& sharedCache = sharedCaches[std::make_pair(model, isFp16)];
+        if(auto weightsCache = sharedCache.lock())
+        {
+            return weightsCache;
+        }
+        auto weightsCache = std::make_shared<WeightsCache>();
+        weightsCache->cache = TfLiteXNNPackDelegateWeightsCacheCreate();
+        if(weightsCache->cache == nullptr)
+        {
+            return nullptr;
+        }
+        sharedCache = weightsCache;
+        return weightsCache;
+    }
+
+    std::vector<std::string> getNoteNames()
+    {
+        static std::array<char const*, 12> const names{"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+        std::vector<std::string> noteNames;
+        for(auto note = 0; note < Bpvp::modelNumNotes; ++note)
+        {
+            auto const midi = note + Bpvp::modelNoteOffset;
+            noteNames.push_back(names.at(static_cast<size_t>(midi % 12)) + std::to_string(midi / 12 - 1));
+        }
+        return noteNames;
+    }
+
+    // The index of the channel is added to the values of the notes when the
+    // channels are analysed separately
+    Vamp::Plugin::FeatureList getNoteFeatures(std::vector<Bpvp::Note> const& notes, std::optional<size_t> channel = {})
+    {
+        Vamp::Plugin::FeatureList fl;
+        fl.reserve(notes.size() * 2);
+        for(auto const& note : notes)
+        {
+            Vamp::Plugin::Feature feature;
+            feature.hasTimestamp = true;
+            feature.timestamp = Vamp::RealTime::fromSeconds(note.start);
+            feature.hasDuration = true;
+            feature.duration = Vamp::RealTime::fromSeconds(note.end) - feature.timestamp;
+            feature.values = {static_cast<float>(note.pitch), static_cast<float>(note.amplitude)};
+            if(channel.has_value())
+            {
+                feature.values.push_back(static_cast<float>(channel.value()));
+            }
+            fl.push_back(std::move(feature));
+            feature.hasTimestamp = true;
+            feature.timestamp = Vamp::RealTime::fromSeconds(note.end);
+            feature.hasDuration = true;
+            feature.duration = Vamp::RealTime();
+            feature.values = {};
+            fl.push_back(std::move(feature));
+        }
+        return fl;
+    }
+
+    // The peak and the mean square of the samples are accumulated in
+    // independent lanes so the compiler can vectorize the loop
+    std::pair<float, float> getEnergy(float const* buffer, size_t size) noexcept
+    {
+        static auto constexpr numLanes = static_cast<size_t>(8);
+        std::array<float, numLanes> peaks{};
+        std::array<float, numLanes> sums{};
+        size_t index = 0;
+        for(; index + numLanes <= size; index += numLanes)
+        {
+            for(size_t lane = 0; lane < numLanes; ++lane)
+            {
+                auto const sample = buffer[index + lane];
+                peaks[lane] = std::max(peaks[lane], std::abs(sample));
+                sums[lane] += sample * sample;
+            }
+        }
+        for(size_t lane = 0; index < size; ++index, ++lane)
+        {
+            peaks[lane] = std::max(peaks[lane], std::abs(buffer[index]));
+            sums[lane] += buffer[index] * buffer[index];
+        }
+        auto const peak = *std::max_element(peaks.cbegin(), peaks.cend());
+        auto const sum = std::accumulate(sums.cbegin(), sums.cend(), 0.0f);
+        return std::make_pair(peak, sum / static_cast<float>(std::max(size, static_cast<size_t>(1))));
+    }
+} // namespace
+
 namespace ResamplerUtils
 {
     template <int k>
@@ -94,15 +367,238 @@ namespace ResamplerUtils
         result += calcCoefficient<4>(inputs[index], offset);
         return result;
     }
+
+    // The modified Bessel function of the first kind used by the Kaiser window
+    static double besselI0(double x) noexcept
+    {
+        auto sum = 1.0;
+        auto term = 1.0;
+        for(auto k = 1; k < 32; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    // The Kaiser windowed sinc low-pass filter at the time t (in input
+    // samples) with the cutoff frequency fc (relative to the input rate)
+    static double windowedSinc(double t, double fc, double halfLength) noexcept
+    {
+        static auto constexpr beta = 8.0;
+        auto const x = t / halfLength;
+        if(std::abs(x) >= 1.0)
+        {
+            return 0.0;
+        }
+        auto const window = besselI0(beta * std::sqrt(1.0 - x * x)) / besselI0(beta);
+        auto const sinc = t == 0.0 ? 1.0 : std::sin(std::numbers::pi * 2.0 * fc * t) / (std::numbers::pi * 2.0 * fc * t);
+        return 2.0 * fc * sinc * window;
+    }
+
+    // The samples are accumulated in independent lanes so the compiler can
+    // vectorize the products without reordering the floating point sums
+    template <size_t numTaps>
+    static forcedinline float dotProduct(float const* lhs, float const* rhs) noexcept
+    {
+        static auto constexpr numLanes = static_cast<size_t>(8);
+        static_assert(numTaps % numLanes == 0);
+        std::array<float, numLanes> sums{};
+        for(size_t index = 0; index < numTaps; index += numLanes)
+        {
+            for(size_t lane = 0; lane < numLanes; ++lane)
+            {
+                sums[lane] += lhs[index + lane] * rhs[index + lane];
+            }
+        }
+        return std::accumulate(sums.cbegin(), sums.cend(), 0.0f);
+    }
+
+    // The half-band filter decimates by 2, all the even taps but the
+    // center one are null so only the odd taps are computed (both sides
+    // are folded since the filter is symmetric)
+    struct HalfBandKernel
+    {
+        static auto constexpr numCoefficients = static_cast<size_t>(16);
+        static auto constexpr numTaps = numCoefficients * 4 - 1;
+        static auto constexpr upFactor = static_cast<size_t>(1);
+        static auto constexpr downFactor = static_cast<size_t>(2);
+
+        static std::array<float, numCoefficients> const& getCoefficients()
+        {
+            static auto const coefficients = []()
+            {
+                std::array<float, numCoefficients> table;
+                auto sum = 0.0;
+                std::array<double, numCoefficients> values;
+                for(size_t index = 0; index < numCoefficients; ++index)
+                {
+                    values[index] = windowedSinc(static_cast<double>(index * 2 + 1), 0.25, static_cast<double>(numTaps / 2 + 1));
+                    sum += values[index];
+                }
+                // The gain at DC is normalized to one
+                for(size_t index = 0; index < numCoefficients; ++index)
+                {
+                    table[index] = static_cast<float>(values[index] * 0.25 / sum);
+                }
+                return table;
+            }();
+            return coefficients;
+        }
+
+        static forcedinline float compute(float const* input, [[maybe_unused]] size_t phase) noexcept
+        {
+            auto const& coefficients = getCoefficients();
+            auto const* center = input + numTaps / 2;
+            std::array<float, numCoefficients> folded;
+            for(size_t index = 0; index < numCoefficients; ++index)
+            {
+                folded[index] = center[-static_cast<long>(index * 2 + 1)] + center[index * 2 + 1];
+            }
+            return 0.5f * center[0] + dotProduct<numCoefficients>(folded.data(), coefficients.data());
+        }
+    };
+
+    // The polyphase filter resamples by the exact ratio between the source
+    // sample rate and the model sample rate, the coefficients of each phase
+    // are computed once
+    template <int sourceSampleRate>
+    struct PolyphaseKernel
+    {
+        static auto constexpr divisor = std::gcd(sourceSampleRate, Bpvp::modelSampleRate);
+        static auto constexpr upFactor = static_cast<size_t>(Bpvp::modelSampleRate / divisor);
+        static auto constexpr downFactor = static_cast<size_t>(sourceSampleRate / divisor);
+        static auto constexpr rollOff = 0.9;
+        static auto constexpr numZeroCrossings = static_cast<size_t>(12);
+        static auto constexpr numTaps = (static_cast<size_t>(2.0 * static_cast<double>(numZeroCrossings * downFactor) / (static_cast<double>(upFactor) * rollOff)) + 8) / 8 * 8;
+        static_assert(upFactor < downFactor, "the polyphase kernel only decimates");
+
+        static std::vector<float> const& getCoefficients()
+        {
+            static auto const coefficients = []()
+            {
+                std::vector<float> table(upFactor * numTaps);
+                auto const fc = 0.5 * rollOff * static_cast<double>(upFactor) / static_cast<double>(downFactor);
+                for(size_t phase = 0; phase < upFactor; ++phase)
+                {
+                    std::vector<double> values(numTaps);
+                    auto const offset = static_cast<double>(numTaps / 2) + static_cast<double>(phase) / static_cast<double>(upFactor);
+                    for(size_t tap = 0; tap < numTaps; ++tap)
+                    {
+                        values[tap] = windowedSinc(static_cast<double>(tap) - offset, fc, static_cast<double>(numTaps / 2));
+                    }
+                    // The gain at DC is normalized to one
+                    auto const sum = std::accumulate(values.cbegin(), values.cend(), 0.0);
+                    std::transform(values.cbegin(), values.cend(), std::next(table.begin(), static_cast<long>(phase * numTaps)), [&](auto const value)
+                                   {
+                                       return static_cast<float>(value / sum);
+                                   });
+                }
+                return table;
+            }();
+            return coefficients;
+        }
+
+        static forcedinline float compute(float const* input, size_t phase) noexcept
+        {
+            return dotProduct<numTaps>(input, getCoefficients().data() + phase * numTaps);
+        }
+    };
 } // namespace ResamplerUtils
 
 void Bpvp::Plugin::Resampler::prepare(double sampleRate)
 {
     mSourceSampleRate = sampleRate;
+    updateMode();
     reset();
 }
 
+void Bpvp::Plugin::Resampler::updateMode() noexcept
+{
+    mMode = Mode::lagrange;
+    mKernelDelay = 0;
+    if(mTargetSampleRate != static_cast<double>(modelSampleRate))
+    {
+        return;
+    }
+    if(mSourceSampleRate == static_cast<double>(modelSampleRate))
+    {
+        mMode = Mode::passThrough;
+    }
+    else if(mSourceSampleRate == 44100.0)
+    {
+        mMode = Mode::halfBand;
+        mKernelDelay = ResamplerUtils::HalfBandKernel::numTaps / 2;
+    }
+    else if(mSourceSampleRate == 48000.0)
+    {
+        mMode = Mode::polyphase48000;
+        mKernelDelay = ResamplerUtils::PolyphaseKernel<48000>::numTaps / 2;
+    }
+    else if(mSourceSampleRate == 88200.0)
+    {
+        mMode = Mode::polyphase88200;
+        mKernelDelay = ResamplerUtils::PolyphaseKernel<88200>::numTaps / 2;
+    }
+    else if(mSourceSampleRate == 96000.0)
+    {
+        mMode = Mode::polyphase96000;
+        mKernelDelay = ResamplerUtils::PolyphaseKernel<96000>::numTaps / 2;
+    }
+}
+
 std::tuple<size_t, size_t> Bpvp::Plugin::Resampler::process(size_t numInputSamples, float const* inputBuffer, size_t numOutputSamples, float* outputBuffer)
+{
+    switch(mMode)
+    {
+        case Mode::passThrough:
+        {
+            auto const numSamples = std::min(numInputSamples, numOutputSamples);
+            std::copy(inputBuffer, inputBuffer + numSamples, outputBuffer);
+            return std::make_tuple(numSamples, numSamples);
+        }
+        case Mode::halfBand:
+            return processKernel<ResamplerUtils::HalfBandKernel>(numInputSamples, inputBuffer, numOutputSamples, outputBuffer);
+        case Mode::polyphase48000:
+            return processKernel<ResamplerUtils::PolyphaseKernel<48000>>(numInputSamples, inputBuffer, numOutputSamples, outputBuffer);
+        case Mode::polyphase88200:
+            return processKernel<ResamplerUtils::PolyphaseKernel<88200>>(numInputSamples, inputBuffer, numOutputSamples, outputBuffer);
+        case Mode::polyphase96000:
+            return processKernel<ResamplerUtils::PolyphaseKernel<96000>>(numInputSamples, inputBuffer, numOutputSamples, outputBuffer);
+        case Mode::lagrange:
+            break;
+    }
+    return processLagrange(numInputSamples, inputBuffer, numOutputSamples, outputBuffer);
+}
+
+template <typename Kernel>
+std::tuple<size_t, size_t> Bpvp::Plugin::Resampler::processKernel(size_t numInputSamples, float const* inputBuffer, size_t numOutputSamples, float* outputBuffer)
+{
+    if(numOutputSamples == 0)
+    {
+        return std::make_tuple(size_t(0), size_t(0));
+    }
+    // Only the input samples required by the output samples are consumed
+    auto const numRequiredSamples = mHistoryPosition + ((numOutputSamples - 1) * Kernel::downFactor + mPhase) / Kernel::upFactor + Kernel::numTaps;
+    auto const numUsedSamples = std::min(numInputSamples, numRequiredSamples > mHistory.size() ? numRequiredSamples - mHistory.size() : size_t(0));
+    mHistory.insert(mHistory.end(), inputBuffer, inputBuffer + numUsedSamples);
+
+    size_t numGeneratedSamples = 0;
+    while(numGeneratedSamples < numOutputSamples && mHistoryPosition + Kernel::numTaps <= mHistory.size())
+    {
+        outputBuffer[numGeneratedSamples++] = Kernel::compute(mHistory.data() + mHistoryPosition, mPhase);
+        mPhase += Kernel::downFactor;
+        mHistoryPosition += mPhase / Kernel::upFactor;
+        mPhase %= Kernel::upFactor;
+    }
+
+    auto const numConsumedSamples = std::min(mHistoryPosition, mHistory.size());
+    mHistory.erase(mHistory.begin(), std::next(mHistory.begin(), static_cast<long>(numConsumedSamples)));
+    mHistoryPosition -= numConsumedSamples;
+    return std::make_tuple(numUsedSamples, numGeneratedSamples);
+}
+
+std::tuple<size_t, size_t> Bpvp::Plugin::Resampler::processLagrange(size_t numInputSamples, float const* inputBuffer, size_t numOutputSamples, float* outputBuffer)
 {
     double const speedRatio = getRatio();
     size_t numGeneratedSamples = 0;
@@ -143,11 +639,17 @@ void Bpvp::Plugin::Resampler::reset()
     mIndexBuffer = 0;
     mSubSamplePos = 1.0;
     std::fill(mLastInputSamples.begin(), mLastInputSamples.end(), 0.0f);
+    // The history starts with half a kernel of silence so the first output
+    // sample is centered on the first input sample
+    mHistory.assign(mKernelDelay, 0.0f);
+    mHistoryPosition = 0;
+    mPhase = 0;
 }
 
 void Bpvp::Plugin::Resampler::setTargetSampleRate(double sampleRate) noexcept
 {
     mTargetSampleRate = sampleRate;
+    updateMode();
 }
 
 double Bpvp::Plugin::Resampler::getRatio() const noexcept
@@ -155,32 +657,95 @@ double Bpvp::Plugin::Resampler::getRatio() const noexcept
     return mSourceSampleRate / mTargetSampleRate;
 }
 
+size_t Bpvp::Plugin::Resampler::getDelay() const noexcept
+{
+    return mKernelDelay;
+}
+
 Bpvp::Plugin::Plugin(float inputSampleRate)
 : Vamp::Plugin(inputSampleRate)
-, mModel(model_uptr(TfLiteModelCreate(Bpvp::model, Bpvp::model_size), [](TfLiteModel* m)
-                    {
-                        if(m != nullptr)
-                        {
-                            TfLiteModelDelete(m);
-                        }
-                    }))
 {
-    if(mModel == nullptr)
+}
+
+Bpvp::Plugin::~Plugin()
+{
+    stopWorker();
+    if(mIsScheduled)
     {
-        BpvpErr("TfLite failed to allocate model!");
+        getScheduler().removeInstance();
     }
-    mResampler.prepare(static_cast<double>(inputSampleRate));
 }
 
 bool Bpvp::Plugin::initialise(size_t channels, size_t stepSize, size_t blockSize)
 {
-    if(channels != static_cast<size_t>(1) || stepSize != blockSize)
+    if(channels < getMinChannelCount() || channels > getMaxChannelCount() || stepSize != blockSize)
+    {
+        return false;
+    }
+    // The instance shares the budget of threads once it is initialised
+    if(!mIsScheduled)
+    {
+        getScheduler().addInstance();
+        mIsScheduled = true;
+    }
+    if(!prepareInterpreter())
     {
         return false;
     }
+    // The contours are only used by the dense outputs
+    mHasContours = mModelHasContours && mDenseOutputs;
+    // The windows of the separate channels are stacked in the same batches,
+    // the batch size falls back to one window if the model cannot be resized
+    // and the live mode only processes one window per channel at a time
+    mNumChannels = channels;
+    auto const numStreams = getNumStreams();
+    prepareWindows(numStreams);
+    auto const batchSize = (mIsLive ? static_cast<size_t>(1) : mBatchSizeParameter) * numStreams;
+    mBatchSize = batchSize;
+    if(!resizeModelBatch(batchSize))
+    {
+        BpvpErr("The model cannot analyse batches of " << batchSize << " windows, the batch size is 1");
+        mBatchSize = 1;
+    }
+    if(auto const profilePath = getEnvironmentVariable("BPVP_PROFILE"); profilePath.has_value())
+    {
+        mProfiler.setEnabled(true);
+        mProfilePath = profilePath.value() == "1" ? "" : profilePath.value();
+    }
+    auto const cacheDirectory = getEnvironmentVariable("BPVP_CACHE_DIR").value_or("");
+    // The silence threshold is part of the key since the skipped windows are
+    // stored with null activations, the entries with and without the
+    // contours are kept apart
+    auto const settingsHash = getHash(&mHasContours, sizeof(mHasContours), getHash(&mSilenceThreshold, sizeof(mSilenceThreshold), static_cast<uint64_t>(mInferenceConfig.backend)));
+    // The cache only stores the windows of the offline mode
+    mCache.prepare(std::filesystem::path(mIsLive ? "" : cacheDirectory), getHash(mModelData, mModelSize, settingsHash), mHasContours);
+    // The memory budget of the accumulated activations (in megabytes) is
+    // divided between the posteriorgrams of the streams, the chunks beyond
+    // the budget are written to temporary files
+    auto const memoryBudget = static_cast<size_t>(std::max(std::atoll(getEnvironmentVariable("BPVP_MEMORY_BUDGET").value_or("0").c_str()), 0LL)) * 1024 * 1024 / (numStreams * 2);
+    std::error_code ec;
+    auto const spillDirectory = std::filesystem::temp_directory_path(ec);
+    mStreams.resize(numStreams);
+    for(auto& stream : mStreams)
+    {
+        stream.resampler.prepare(static_cast<double>(getInputSampleRate()));
+        stream.inputBuffer.assign(mWindowSize * 2, 0.0f);
+        stream.accumulatedFrames.setMemoryBudget(ec ? 0 : memoryBudget, spillDirectory);
+        stream.accumulatedOnsets.setMemoryBudget(ec ? 0 : memoryBudget, spillDirectory);
+    }
+    mMixBuffer.resize(numStreams < channels ? blockSize : 0);
+    mAudioBuffer.resize(mBatchSize * mWindowSize);
     reset();
     mBlockSize = blockSize;
-    return mInterpreter != nullptr;
+    if(mBackgroundInference > 0)
+    {
+        startWorker(mBackgroundInference + 1);
+    }
+    else
+    {
+        stopWorker();
+    }
+    return true;
 }
 
 std::string Bpvp::Plugin::getIdentifier() const
@@ -218,6 +783,16 @@ Bpvp::Plugin::InputDomain Bpvp::Plugin::getInputDomain() const
     return TimeDomain;
 }
 
+size_t Bpvp::Plugin::getMinChannelCount() const
+{
+    return static_cast<size_t>(1);
+}
+
+size_t Bpvp::Plugin::getMaxChannelCount() const
+{
+    return maxNumChannels;
+}
+
 size_t Bpvp::Plugin::getPreferredBlockSize() const
 {
     return static_cast<size_t>(1024);
@@ -230,6 +805,7 @@ size_t Bpvp::Plugin::getPreferredStepSize() const
 
 Bpvp::Plugin::OutputList Bpvp::Plugin::getOutputDescriptors() const
 {
+    OutputList list;
     OutputDescriptor d;
     d.identifier = "pitch";
     d.name = "Pitch";
@@ -243,12 +819,63 @@ Bpvp::Plugin::OutputList Bpvp::Plugin::getOutputDescriptors() const
     d.isQuantized = false;
     d.sampleType = OutputDescriptor::SampleType::VariableSampleRate;
     d.hasDuration = true;
-    return {d};
+    list.push_back(d);
+
+    // The bins of the channels are concatenated when they are analysed
+    // separately
+    auto const numStreams = getNumStreams();
+    auto const addActivations = [&](std::string identifier, std::string name, std::string description, size_t binCount, std::vector<std::string> binNames)
+    {
+        if(numStreams > 1)
+        {
+            auto const channelBinNames = std::move(binNames);
+            binNames.clear();
+            for(size_t channel = 0; channel < numStreams && !channelBinNames.empty(); ++channel)
+            {
+                for(auto const& binName : channelBinNames)
+                {
+                    binNames.push_back("Ch" + std::to_string(channel + 1) + " " + binName);
+                }
+            }
+        }
+        OutputDescriptor od;
+        od.identifier = std::move(identifier);
+        od.name = std::move(name);
+        od.description = std::move(description);
+        od.unit = "";
+        od.hasFixedBinCount = true;
+        od.binCount = binCount * numStreams;
+        od.binNames = std::move(binNames);
+        od.hasKnownExtents = true;
+        od.minValue = 0.0f;
+        od.maxValue = 1.0f;
+        od.isQuantized = false;
+        od.sampleType = OutputDescriptor::SampleType::FixedSampleRate;
+        od.sampleRate = static_cast<float>(static_cast<double>(modelNumValidFrames) / modelBlockDuration);
+        od.hasDuration = false;
+        list.push_back(std::move(od));
+    };
+    addActivations("onsets", "Onsets", "Onset activations of the notes estimated by the model", static_cast<size_t>(modelNumNotes), getNoteNames());
+    addActivations("frames", "Frames", "Frame activations of the notes estimated by the model", static_cast<size_t>(modelNumNotes), getNoteNames());
+    addActivations("contour", "Contour", "Pitch contour activations estimated by the model (three bins per semitone)", static_cast<size_t>(modelNumContourBins), {});
+
+    if(mThresholdPresets)
+    {
+        for(auto const& preset : thresholdPresets)
+        {
+            d.identifier = preset.identifier;
+            d.name = std::string("Pitch (") + preset.name + ")";
+            d.description = std::string("Pitch estimated from the input signal with the ") + preset.name + " thresholds";
+            list.push_back(d);
+        }
+    }
+    return list;
 }
 
-void Bpvp::Plugin::reset()
+bool Bpvp::Plugin::createInterpreter(InferenceConfig const& config, delegate_uptr& delegate, interpreter_uptr& interpreter) const
 {
-    mInterpreter.reset();
+    interpreter.reset();
+    delegate.reset();
     auto options = interpreter_options_uptr(TfLiteInterpreterOptionsCreate(), [](TfLiteInterpreterOptions* o)
                                             {
                                                 if(o != nullptr)
@@ -259,85 +886,484 @@ void Bpvp::Plugin::reset()
     if(options == nullptr)
     {
         BpvpErr("TfLite failed to allocate option!");
+        return false;
     }
-    else
+    auto const numThreads = static_cast<int32_t>(std::max(config.numThreads, static_cast<size_t>(1)));
+    TfLiteInterpreterOptionsSetNumThreads(options.get(), numThreads);
+    std::shared_ptr<WeightsCache> weightsCache;
+    if(config.backend == Backend::xnnpack || config.backend == Backend::xnnpackFp16)
     {
-        mInterpreter = interpreter_uptr(TfLiteInterpreterCreate(mModel.get(), options.get()), [](TfLiteInterpreter* i)
-                                        {
-                                            if(i != nullptr)
-                                            {
-                                                TfLiteInterpreterDelete(i);
-                                            }
-                                        });
-        if(mInterpreter == nullptr)
+        auto delegateOptions = TfLiteXNNPackDelegateOptionsDefault();
+        delegateOptions.num_threads = numThreads;
+        if(config.backend == Backend::xnnpackFp16)
         {
-            BpvpErr("TfLite failed to allocate interpreter!");
+            delegateOptions.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_FORCE_FP16;
         }
-        else
+        // The delegate keeps the weights cache until it is deleted
+        weightsCache = getSharedWeightsCache(mModel.get(), config.backend == Backend::xnnpackFp16);
+        delegateOptions.weights_cache = weightsCache != nullptr ? weightsCache->cache : nullptr;
+        delegate = delegate_uptr(TfLiteXNNPackDelegateCreate(&delegateOptions), [weightsCache](TfLiteDelegate* d)
+                                 {
+                                     if(d != nullptr)
+                                     {
+                                         TfLiteXNNPackDelegateDelete(d);
+                                     }
+                                 });
+        if(delegate == nullptr)
         {
-            auto const result = TfLiteInterpreterAllocateTensors(mInterpreter.get());
-            if(result != TfLiteStatus::kTfLiteOk)
-            {
-                BpvpErr("TfLite failed to allocate tensors!");
-                mInterpreter.reset();
-            }
-            else
-            {
-                print(mInterpreter.get());
-            }
+            BpvpErr("TfLite failed to allocate XNNPack delegate!");
+            return false;
         }
+        TfLiteInterpreterOptionsAddDelegate(options.get(), delegate.get());
     }
-    std::fill(mInputBuffer.begin(), mInputBuffer.end(), 0.0f);
-    mInputBufferPosition = 0;
-    mResampler.reset();
-    mAccumulatedFrames.clear();
-    mAccumulatedOnsets.clear();
-}
 
-Bpvp::Plugin::ParameterList Bpvp::Plugin::getParameterDescriptors() const
-{
-    ParameterList list;
+    // The weights are packed in the cache when the delegate is applied to the
+    // model, the cache must be finalised before the tensors are allocated
     {
-        ParameterDescriptor param;
-        param.identifier = "voiceindex";
-        param.name = "Voice Index";
-        param.description = "The index of the voice";
-        param.unit = "";
-        param.minValue = 0.0f;
-        param.maxValue = 23.0f;
-        param.defaultValue = 0.0f;
-        param.isQuantized = true;
-        param.quantizeStep = 1.0f;
-        list.push_back(std::move(param));
+        std::unique_lock<std::mutex> lock;
+        if(weightsCache != nullptr)
+        {
+            lock = std::unique_lock<std::mutex>(weightsCache->mutex);
+        }
+        interpreter = interpreter_uptr(TfLiteInterpreterCreate(mModel.get(), options.get()), [](TfLiteInterpreter* i)
+                                       {
+                                           if(i != nullptr)
+                                           {
+                                               TfLiteInterpreterDelete(i);
+                                           }
+                                       });
+        if(interpreter != nullptr && weightsCache != nullptr && !weightsCache->isFinalised)
+        {
+            weightsCache->isFinalised = TfLiteXNNPackDelegateWeightsCacheFinalizeSoft(weightsCache->cache);
+        }
     }
+    if(interpreter == nullptr)
     {
-        ParameterDescriptor param;
-        param.identifier = "framethreshold";
-        param.name = "Frame Threshold";
-        param.description = "The frame's amplitude threshold";
-        param.unit = "";
-        param.minValue = 0.05f;
-        param.maxValue = 0.95f;
-        param.defaultValue = 0.7f;
-        param.isQuantized = true;
-        param.quantizeStep = 0.01f;
-        list.push_back(std::move(param));
+        BpvpErr("TfLite failed to allocate interpreter!");
+        delegate.reset();
+        return false;
     }
+    auto const result = TfLiteInterpreterAllocateTensors(interpreter.get());
+    if(result != TfLiteStatus::kTfLiteOk)
     {
-        ParameterDescriptor param;
-        param.identifier = "onsetthreshold";
-        param.name = "Onset Threshold";
-        param.description = "The onset's amplitude threshold";
-        param.unit = "";
-        param.minValue = 0.05f;
-        param.maxValue = 0.95f;
-        param.defaultValue = 0.5f;
-        param.isQuantized = true;
-        param.quantizeStep = 0.01f;
-        list.push_back(std::move(param));
+        BpvpErr("TfLite failed to allocate tensors!");
+        interpreter.reset();
+        delegate.reset();
+        return false;
     }
+    print(interpreter.get());
+    return true;
+}
+
+std::tuple<void const*, size_t> Bpvp::Plugin::getModelData(Precision precision)
+{
+    switch(precision)
     {
-        ParameterDescriptor param;
+        case Precision::float32:
+            return {model, model_size};
+        case Precision::float16:
+            return {model_fp16, model_fp16_size};
+        case Precision::int8:
+            return {model_int8, model_int8_size};
+    }
+    return {nullptr, 0};
+}
+
+Bpvp::Plugin::Precision Bpvp::Plugin::getModelPrecision() const
+{
+    auto precision = static_cast<Precision>(mPrecision);
+    // The environment variable overrides the parameter
+    if(auto const name = getEnvironmentVariable("BPVP_MODEL_PRECISION"); name.has_value())
+    {
+        static std::map<std::string, Precision> const precisions{{"float32", Precision::float32}, {"float16", Precision::float16}, {"int8", Precision::int8}};
+        auto const it = precisions.find(name.value());
+        if(it != precisions.cend())
+        {
+            precision = it->second;
+        }
+        else
+        {
+            std::cerr << "Invalid BPVP_MODEL_PRECISION : " << name.value() << "\n";
+        }
+    }
+    // The reduced precision variants are optional in the build
+    if(std::get<1>(getModelData(precision)) == 0)
+    {
+        std::cerr << "The model with reduced precision is not available, the float32 model is used\n";
+        return Precision::float32;
+    }
+    return precision;
+}
+
+Bpvp::Plugin::InferenceConfig Bpvp::Plugin::getInferenceConfig() const
+{
+    InferenceConfig config;
+    config.backend = static_cast<Backend>(mBackend);
+    config.numThreads = mNumThreads;
+
+    // The environment variables override the parameters
+    if(auto const backend = getEnvironmentVariable("BPVP_BACKEND"); backend.has_value())
+    {
+        static std::map<std::string, Backend> const backends{{"auto", Backend::automatic}, {"builtin", Backend::builtin}, {"xnnpack", Backend::xnnpack}, {"xnnpack-fp16", Backend::xnnpackFp16}};
+        auto const it = backends.find(backend.value());
+        if(it != backends.cend())
+        {
+            config.backend = it->second;
+        }
+        else
+        {
+            std::cerr << "Invalid BPVP_BACKEND : " << backend.value() << "\n";
+        }
+    }
+    if(auto const numThreads = getEnvironmentVariable("BPVP_NUM_THREADS"); numThreads.has_value())
+    {
+        config.numThreads = static_cast<size_t>(std::max(std::atoi(numThreads.value().c_str()), 0));
+    }
+    if(config.backend == Backend::automatic || config.numThreads == 0)
+    {
+        config = tuneInferenceConfig(config);
+    }
+    // The threads are limited to the share of the instance in the budget
+    config.numThreads = std::min(config.numThreads, getScheduler().getThreadShare());
+    return config;
+}
+
+Bpvp::Plugin::InferenceConfig Bpvp::Plugin::tuneInferenceConfig(InferenceConfig const& config) const
+{
+    // The tuning only depends on the CPU and the model, so the result is
+    // shared by all the instances of the process
+    static std::mutex tuningMutex;
+    static std::map<std::tuple<void const*, Backend, size_t>, InferenceConfig> tunedConfigs;
+    std::scoped_lock lock(tuningMutex);
+    auto const key = std::make_tuple(mModelData, config.backend, config.numThreads);
+    if(auto const it = tunedConfigs.find(key); it != tunedConfigs.cend())
+    {
+        return it->second;
+    }
+
+    std::vector<Backend> backends;
+    if(config.backend == Backend::automatic)
+    {
+        backends = {Backend::builtin, Backend::xnnpack, Backend::xnnpackFp16};
+    }
+    else
+    {
+        backends = {config.backend};
+    }
+    std::vector<size_t> threads;
+    if(config.numThreads == 0)
+    {
+        auto const maxThreads = getScheduler().getBudget();
+        for(size_t numThreads = 1; numThreads < maxThreads; numThreads *= 2)
+        {
+            threads.push_back(numThreads);
+        }
+        threads.push_back(maxThreads);
+    }
+    else
+    {
+        threads = {config.numThreads};
+    }
+
+    std::vector<float> audio(modelBlockSize);
+    for(size_t index = 0; index < audio.size(); ++index)
+    {
+        auto const time = static_cast<double>(index) / static_cast<double>(modelSampleRate);
+        audio[index] = static_cast<float>(0.25 * std::sin(2.0 * std::numbers::pi * 440.0 * time) + 0.25 * std::sin(2.0 * std::numbers::pi * 659.25 * time));
+    }
+
+    static auto constexpr numWarmUpInvokes = 1;
+    static auto constexpr numTimedInvokes = 2;
+    auto bestConfig = InferenceConfig{config.backend == Backend::automatic ? Backend::builtin : config.backend, threads.front()};
+    auto bestDuration = std::chrono::steady_clock::duration::max();
+    for(auto const backend : backends)
+    {
+        for(auto const numThreads : threads)
+        {
+            auto const candidate = InferenceConfig{backend, numThreads};
+            delegate_uptr delegate{nullptr, nullptr};
+            interpreter_uptr interpreter{nullptr, nullptr};
+            if(!createInterpreter(candidate, delegate, interpreter))
+            {
+                continue;
+            }
+            auto* input = TfLiteInterpreterGetInputTensor(interpreter.get(), 0);
+            auto const invoke = [&]()
+            {
+                return TfLiteTensorCopyFromBuffer(input, audio.data(), audio.size() * sizeof(float)) == kTfLiteOk && TfLiteInterpreterInvoke(interpreter.get()) == kTfLiteOk;
+            };
+            // The candidates are measured within the budget of the process
+            // like the inferences
+            Scheduler::Scope reservation(getScheduler(), numThreads);
+            auto succeeded = true;
+            for(auto index = 0; index < numWarmUpInvokes && succeeded; ++index)
+            {
+                succeeded = invoke();
+            }
+            auto const start = std::chrono::steady_clock::now();
+            for(auto index = 0; index < numTimedInvokes && succeeded; ++index)
+            {
+                succeeded = invoke();
+            }
+            auto const duration = std::chrono::steady_clock::now() - start;
+            if(succeeded && duration < bestDuration)
+            {
+                bestDuration = duration;
+                bestConfig = candidate;
+            }
+        }
+    }
+    BpvpDbg("Tuned backend " << static_cast<int>(bestConfig.backend) << " with " << bestConfig.numThreads << " threads");
+    tunedConfigs[key] = bestConfig;
+    return bestConfig;
+}
+
+bool Bpvp::Plugin::prepareInterpreter()
+{
+    collectSlots(true, true);
+    // The external model replaces the embedded models
+    auto const precision = getModelPrecision();
+    auto const modelPath = getEnvironmentVariable("BPVP_MODEL_PATH").value_or("");
+    if(mModel == nullptr || precision != mModelPrecision || modelPath != mModelPath)
+    {
+        // The interpreter of the previous model is released before the model
+        mInterpreter.reset();
+        mDelegate.reset();
+        mModel.reset();
+        if(!modelPath.empty())
+        {
+            mModel = getSharedModel(std::filesystem::path(modelPath), mModelData, mModelSize);
+            if(mModel == nullptr)
+            {
+                std::cerr << "The model " << modelPath << " cannot be loaded, the embedded model is used\n";
+            }
+        }
+        if(mModel == nullptr)
+        {
+            std::tie(mModelData, mModelSize) = getModelData(precision);
+            mModel = getSharedModel(mModelData, mModelSize);
+        }
+        if(mModel == nullptr)
+        {
+            BpvpErr("TfLite failed to allocate model!");
+            return false;
+        }
+        mModelPrecision = precision;
+        mModelPath = modelPath;
+    }
+
+    // The interpreter is only created once and reused as long as the
+    // inference configuration doesn't change
+    auto const config = getInferenceConfig();
+    if(mInterpreter != nullptr && config == mInferenceConfig)
+    {
+        return true;
+    }
+    mInferenceConfig = config;
+    mModelBatchSize = 1;
+    mModelWindowSize = modelBlockSize;
+    if(!createInterpreter(mInferenceConfig, mDelegate, mInterpreter))
+    {
+        return false;
+    }
+    auto const numOutputs = TfLiteInterpreterGetOutputTensorCount(mInterpreter.get());
+    if(numOutputs > 2)
+    {
+        auto const* contours = TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 2);
+        mModelHasContours = TfLiteTensorDim(contours, TfLiteTensorNumDims(contours) - 1) == modelNumContourBins;
+    }
+    else
+    {
+        mModelHasContours = false;
+    }
+
+    // The warm-up inference prevents the first block from paying the
+    // preparation of the kernels (such as the XNNPACK weights packing)
+    if(getEnvironmentVariable("BPVP_WARMUP").value_or("1") != "0")
+    {
+        std::vector<float> const silence(modelBlockSize, 0.0f);
+        Scheduler::Scope reservation(getScheduler(), mInferenceConfig.numThreads);
+        if(TfLiteTensorCopyFromBuffer(TfLiteInterpreterGetInputTensor(mInterpreter.get(), 0), silence.data(), silence.size() * sizeof(float)) != kTfLiteOk || TfLiteInterpreterInvoke(mInterpreter.get()) != kTfLiteOk)
+        {
+            BpvpErr("TfLite failed to run the warm-up inference!");
+            mInterpreter.reset();
+            mDelegate.reset();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Bpvp::Plugin::reset()
+{
+    collectSlots(true, true);
+    mNumBatchedWindows = 0;
+    mBatchedWindows.clear();
+    // The first window starts with silence as left context
+    mInputBufferStart = 0;
+    mInputBufferPosition = mNumContextFrames * modelFFTHope;
+    for(auto& stream : mStreams)
+    {
+        std::fill(stream.inputBuffer.begin(), stream.inputBuffer.end(), 0.0f);
+        stream.resampler.reset();
+        stream.accumulatedFrames.clear();
+        stream.accumulatedOnsets.clear();
+        stream.decoders.resize(getNumDecoders());
+        for(size_t decoderIndex = 0; decoderIndex < stream.decoders.size(); ++decoderIndex)
+        {
+            stream.decoders[decoderIndex].prepare(getDecoderSettings(decoderIndex), mNumLookbackFrames);
+        }
+    }
+    mNumQueuedWindows = 0;
+    mNumAddedWindows = 0;
+    mNextOutputStream = 0;
+    mFinalWindow = std::numeric_limits<size_t>::max();
+    mNumFinalWindowFrames = mNumHopFrames;
+    mPendingFeatures.clear();
+    mNumOutputFrames = 0;
+    mCache.reset();
+    mProfiler.reset();
+}
+
+void Bpvp::Plugin::prepareWindows(size_t numStreams)
+{
+    // The live windows keep the context before the new frames of the
+    // offline windows but the context after the new frames is reduced to
+    // fit the latency budget
+    mIsLive = mLiveMode;
+    if(mIsLive)
+    {
+        auto const numHopFrames = static_cast<size_t>(std::max(std::round(static_cast<double>(mLiveHop) / frameDuration), 1.0));
+        auto const numBudgetFrames = static_cast<size_t>(std::floor(static_cast<double>(mLatencyBudget) / frameDuration));
+        auto const numTrailingFrames = std::min(numBudgetFrames > numHopFrames ? numBudgetFrames - numHopFrames : static_cast<size_t>(0), static_cast<size_t>(modelNumTrimmedFrames));
+        mNumContextFrames = modelNumTrimmedFrames;
+        mNumHopFrames = numHopFrames;
+        mNumWindowFrames = mNumContextFrames + mNumHopFrames + numTrailingFrames;
+        mWindowSize = modelBlockSize - (modelNumFrames - mNumWindowFrames) * modelFFTHope;
+        mNumLookbackFrames = std::max(numBudgetFrames, mNumHopFrames + numTrailingFrames);
+        if(resizeModelBatch(numStreams))
+        {
+            return;
+        }
+        BpvpErr("The model cannot analyse windows of " << mWindowSize << " samples, the offline mode is used");
+        mIsLive = false;
+    }
+    mNumContextFrames = modelNumTrimmedFrames;
+    mNumHopFrames = modelNumValidFrames;
+    mNumWindowFrames = modelNumFrames;
+    mWindowSize = modelBlockSize;
+    mNumLookbackFrames = decoderLookbackFrames;
+}
+
+size_t Bpvp::Plugin::getWindowPosition(size_t window) const noexcept
+{
+    // The hop of the windows follows the rate of the frames of the offline
+    // windows so the live windows have the same timeline
+    static auto constexpr effectiveBlockSize = modelBlockSize - modelBlockPadding;
+    return window * mNumHopFrames * effectiveBlockSize / modelNumValidFrames;
+}
+
+size_t Bpvp::Plugin::getNumTrailingFrames() const noexcept
+{
+    return mNumWindowFrames - mNumContextFrames - mNumHopFrames;
+}
+
+bool Bpvp::Plugin::isStreamingNotes() const noexcept
+{
+    return mStreamNotes || mIsLive;
+}
+
+size_t Bpvp::Plugin::getNumStreams() const noexcept
+{
+    return mSeparateChannels ? mNumChannels : static_cast<size_t>(1);
+}
+
+std::optional<size_t> Bpvp::Plugin::getChannelTag(size_t streamIndex) const noexcept
+{
+    if(mSeparateChannels)
+    {
+        return streamIndex;
+    }
+    return {};
+}
+
+size_t Bpvp::Plugin::getNumDecoders() const noexcept
+{
+    return 1 + (mThresholdPresets ? thresholdPresets.size() : 0);
+}
+
+// The outputs of the presets follow the dense outputs
+size_t Bpvp::Plugin::getNoteOutputIndex(size_t decoderIndex) const noexcept
+{
+    return decoderIndex == 0 ? 0 : decoderIndex + 3;
+}
+
+// The first decoder uses the parameters, the next ones use the presets
+Bpvp::Decoder::Settings Bpvp::Plugin::getDecoderSettings(size_t decoderIndex) const
+{
+    auto const isPreset = decoderIndex > 0 && decoderIndex <= thresholdPresets.size();
+    Decoder::Settings settings;
+    settings.inferOnsets = true;
+    settings.voiceIndex = mVoiceIndex;
+    settings.frameEnergyThreshold = isPreset ? thresholdPresets[decoderIndex - 1].frameThreshold : mFrameThreshold;
+    settings.onsetEnergyThreshold = isPreset ? thresholdPresets[decoderIndex - 1].onsetThreshold : mOnsetThreshold;
+    settings.minNoteDuration = static_cast<double>(isPreset ? thresholdPresets[decoderIndex - 1].minNoteDuration : mMinNoteDuration) / 1000.0;
+    settings.maxFramesBelowThreshold = 11;
+    settings.minFreq = 80.0f;
+    settings.maxFreq = 8000.0f;
+    settings.melodiaTrick = true;
+    return settings;
+}
+
+Bpvp::Plugin::ParameterList Bpvp::Plugin::getParameterDescriptors() const
+{
+    ParameterList list;
+    {
+        ParameterDescriptor param;
+        param.identifier = "voiceindex";
+        param.name = "Voice Index";
+        param.description = "The index of the voice (the overlapping notes are assigned to different voices, all the voices are returned by default)";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 24.0f;
+        param.defaultValue = 0.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames.push_back("All");
+        for(auto voice = 1; voice <= 24; ++voice)
+        {
+            param.valueNames.push_back(std::to_string(voice));
+        }
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "framethreshold";
+        param.name = "Frame Threshold";
+        param.description = "The frame's amplitude threshold";
+        param.unit = "";
+        param.minValue = 0.05f;
+        param.maxValue = 0.95f;
+        param.defaultValue = 0.7f;
+        param.isQuantized = true;
+        param.quantizeStep = 0.01f;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "onsetthreshold";
+        param.name = "Onset Threshold";
+        param.description = "The onset's amplitude threshold";
+        param.unit = "";
+        param.minValue = 0.05f;
+        param.maxValue = 0.95f;
+        param.defaultValue = 0.5f;
+        param.isQuantized = true;
+        param.quantizeStep = 0.01f;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
         param.identifier = "minnoteduration";
         param.name = "Minimum Note Duration";
         param.description = "The minimum note duration";
@@ -349,6 +1375,180 @@ Bpvp::Plugin::ParameterList Bpvp::Plugin::getParameterDescriptors() const
         param.quantizeStep = 1.0f;
         list.push_back(std::move(param));
     }
+    {
+        ParameterDescriptor param;
+        param.identifier = "silencethreshold";
+        param.name = "Silence Threshold";
+        param.description = "The RMS level below which the analysis windows are considered silent and skipped by the inference, the minimum value only skips the digital silence";
+        param.unit = "dB";
+        param.minValue = minSilenceThreshold;
+        param.maxValue = -20.0f;
+        param.defaultValue = minSilenceThreshold;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "channelmode";
+        param.name = "Channel Mode";
+        param.description = "Analyses the average of the channels or each channel separately";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 1.0f;
+        param.defaultValue = 0.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Mix", "Separate"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "streamnotes";
+        param.name = "Stream Notes";
+        param.description = "Outputs the notes progressively during the analysis instead of at the end";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 1.0f;
+        param.defaultValue = 0.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "thresholdpresets";
+        param.name = "Threshold Presets";
+        param.description = "Adds the notes decoded with conservative, balanced and sensitive thresholds from the same inference";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 1.0f;
+        param.defaultValue = 0.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Off", "On"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "denseoutputs";
+        param.name = "Dense Outputs";
+        param.description = "Outputs the onsets, the frames and the contours of the neural network, the notes are faster to analyse without them";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 1.0f;
+        param.defaultValue = 1.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Off", "On"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "livemode";
+        param.name = "Live Mode";
+        param.description = "Analyses shorter windows with a reduced context to output the notes with a low latency";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 1.0f;
+        param.defaultValue = 0.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Off", "On"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "livehop";
+        param.name = "Live Hop";
+        param.description = "The duration of the new audio analysed by each window in live mode";
+        param.unit = "ms";
+        param.minValue = minLiveHop;
+        param.maxValue = maxLiveHop;
+        param.defaultValue = 100.0f;
+        param.isQuantized = false;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "latency";
+        param.name = "Latency Budget";
+        param.description = "The maximum delay of the notes in live mode, the context after the new audio is reduced to fit the budget";
+        param.unit = "ms";
+        param.minValue = minLatencyBudget;
+        param.maxValue = maxLatencyBudget;
+        param.defaultValue = 300.0f;
+        param.isQuantized = false;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "backgroundinference";
+        param.name = "Background Inference";
+        param.description = "Runs the model inference in a background thread using a double or a triple buffer";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 2.0f;
+        param.defaultValue = 0.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Off", "Double Buffer", "Triple Buffer"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "backend";
+        param.name = "Inference Backend";
+        param.description = "The backend used by the inference, the automatic mode selects the fastest backend for the CPU";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 3.0f;
+        param.defaultValue = static_cast<float>(Backend::builtin);
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Auto", "Built-in", "XNNPACK", "XNNPACK FP16"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "modelprecision";
+        param.name = "Model Precision";
+        param.description = "The precision of the weights of the model, the reduced precisions are faster but less accurate (the float32 model is used if the variant is not embedded)";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 2.0f;
+        param.defaultValue = static_cast<float>(Precision::float32);
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        param.valueNames = {"Float32", "Float16", "Int8"};
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "numthreads";
+        param.name = "Inference Threads";
+        param.description = "The number of threads used by the inference, zero selects the fastest number of threads for the CPU";
+        param.unit = "";
+        param.minValue = 0.0f;
+        param.maxValue = 64.0f;
+        param.defaultValue = 1.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        list.push_back(std::move(param));
+    }
+    {
+        ParameterDescriptor param;
+        param.identifier = "batchsize";
+        param.name = "Batch Size";
+        param.description = "The number of analysis windows processed by each inference";
+        param.unit = "";
+        param.minValue = 1.0f;
+        param.maxValue = 16.0f;
+        param.defaultValue = 1.0f;
+        param.isQuantized = true;
+        param.quantizeStep = 1.0f;
+        list.push_back(std::move(param));
+    }
     return list;
 }
 
@@ -356,7 +1556,7 @@ void Bpvp::Plugin::setParameter(std::string paramid, float newval)
 {
     if(paramid == "voiceindex")
     {
-        mVoiceIndex = static_cast<size_t>(std::round(std::clamp(newval, 0.0f, 23.0f)));
+        mVoiceIndex = static_cast<size_t>(std::round(std::clamp(newval, 0.0f, 24.0f)));
     }
     else if(paramid == "framethreshold")
     {
@@ -366,42 +1566,156 @@ void Bpvp::Plugin::setParameter(std::string paramid, float newval)
     {
         mOnsetThreshold = std::clamp(newval, 0.05f, 0.95f);
     }
-    else if(paramid == "minnoteduration")
+    else if(paramid == "minnoteduration")
+    {
+        mMinNoteDuration = static_cast<int>(std::round(std::clamp(newval, 0.0f, 1000.0f)));
+    }
+    else if(paramid == "silencethreshold")
+    {
+        mSilenceThreshold = std::round(std::clamp(newval, minSilenceThreshold, -20.0f));
+    }
+    else if(paramid == "channelmode")
+    {
+        mSeparateChannels = newval > 0.5f;
+    }
+    else if(paramid == "streamnotes")
+    {
+        mStreamNotes = newval > 0.5f;
+    }
+    else if(paramid == "thresholdpresets")
+    {
+        mThresholdPresets = newval > 0.5f;
+    }
+    else if(paramid == "denseoutputs")
+    {
+        mDenseOutputs = newval > 0.5f;
+    }
+    else if(paramid == "livemode")
+    {
+        mLiveMode = newval > 0.5f;
+    }
+    else if(paramid == "livehop")
+    {
+        mLiveHop = std::clamp(newval, minLiveHop, maxLiveHop);
+    }
+    else if(paramid == "latency")
+    {
+        mLatencyBudget = std::clamp(newval, minLatencyBudget, maxLatencyBudget);
+    }
+    else if(paramid == "backgroundinference")
+    {
+        mBackgroundInference = static_cast<size_t>(std::round(std::clamp(newval, 0.0f, 2.0f)));
+    }
+    else if(paramid == "backend")
+    {
+        mBackend = static_cast<size_t>(std::round(std::clamp(newval, 0.0f, 3.0f)));
+    }
+    else if(paramid == "modelprecision")
+    {
+        mPrecision = static_cast<size_t>(std::round(std::clamp(newval, 0.0f, 2.0f)));
+    }
+    else if(paramid == "numthreads")
+    {
+        mNumThreads = static_cast<size_t>(std::round(std::clamp(newval, 0.0f, 64.0f)));
+    }
+    else if(paramid == "batchsize")
+    {
+        mBatchSizeParameter = static_cast<size_t>(std::round(std::clamp(newval, 1.0f, 16.0f)));
+    }
+    else
+    {
+        std::cerr << "Invalid parameter : " << paramid << "\n";
+    }
+}
+
+float Bpvp::Plugin::getParameter(std::string paramid) const
+{
+    if(paramid == "voiceindex")
+    {
+        return static_cast<float>(mVoiceIndex);
+    }
+    if(paramid == "framethreshold")
+    {
+        return mFrameThreshold;
+    }
+    if(paramid == "onsetthreshold")
+    {
+        return mOnsetThreshold;
+    }
+    if(paramid == "minnoteduration")
+    {
+        return static_cast<float>(mMinNoteDuration);
+    }
+    if(paramid == "silencethreshold")
+    {
+        return mSilenceThreshold;
+    }
+    if(paramid == "channelmode")
+    {
+        return mSeparateChannels ? 1.0f : 0.0f;
+    }
+    if(paramid == "streamnotes")
+    {
+        return mStreamNotes ? 1.0f : 0.0f;
+    }
+    if(paramid == "thresholdpresets")
+    {
+        return mThresholdPresets ? 1.0f : 0.0f;
+    }
+    if(paramid == "denseoutputs")
+    {
+        return mDenseOutputs ? 1.0f : 0.0f;
+    }
+    if(paramid == "livemode")
+    {
+        return mLiveMode ? 1.0f : 0.0f;
+    }
+    if(paramid == "livehop")
+    {
+        return mLiveHop;
+    }
+    if(paramid == "latency")
     {
-        mMinNoteDuration = static_cast<int>(std::round(std::clamp(newval, 0.0f, 1000.0f)));
+        return mLatencyBudget;
     }
-    else
+    if(paramid == "backgroundinference")
     {
-        std::cerr << "Invalid parameter : " << paramid << "\n";
+        return static_cast<float>(mBackgroundInference);
     }
-}
-
-float Bpvp::Plugin::getParameter(std::string paramid) const
-{
-    if(paramid == "voiceindex")
+    if(paramid == "backend")
     {
-        return static_cast<float>(mVoiceIndex);
+        return static_cast<float>(mBackend);
     }
-    if(paramid == "framethreshold")
+    if(paramid == "modelprecision")
     {
-        return mFrameThreshold;
+        return static_cast<float>(mPrecision);
     }
-    if(paramid == "onsetthreshold")
+    if(paramid == "numthreads")
     {
-        return mOnsetThreshold;
+        return static_cast<float>(mNumThreads);
     }
-    if(paramid == "minnoteduration")
+    if(paramid == "batchsize")
     {
-        return static_cast<float>(mMinNoteDuration);
+        return static_cast<float>(mBatchSizeParameter);
     }
     std::cerr << "Invalid parameter : " << paramid << "\n";
     return 0.0f;
 }
 
+void Bpvp::Plugin::setInputSampleRate(float sampleRate)
+{
+    m_inputSampleRate = sampleRate;
+}
+
+Bpvp::Profiler& Bpvp::Plugin::getProfiler() noexcept
+{
+    return mProfiler;
+}
+
 Bpvp::Plugin::OutputExtraList Bpvp::Plugin::getOutputExtraDescriptors(size_t outputDescriptorIndex) const
 {
     OutputExtraList list;
-    if(outputDescriptorIndex == 0)
+    if(outputDescriptorIndex == 0 || outputDescriptorIndex > 3)
     {
         OutputExtraDescriptor d;
         d.identifier = "amplitude";
@@ -414,100 +1728,741 @@ Bpvp::Plugin::OutputExtraList Bpvp::Plugin::getOutputExtraDescriptors(size_t out
         d.isQuantized = false;
         d.quantizeStep = 0.0f;
         list.push_back(std::move(d));
+        if(mSeparateChannels)
+        {
+            d.identifier = "channel";
+            d.name = "Channel";
+            d.description = "The index of the channel of the note";
+            d.unit = "";
+            d.hasKnownExtents = true;
+            d.minValue = 0.0f;
+            d.maxValue = static_cast<float>(mNumChannels - 1);
+            d.isQuantized = true;
+            d.quantizeStep = 1.0f;
+            list.push_back(std::move(d));
+        }
     }
     return list;
 }
 
-void Bpvp::Plugin::processModel()
+void Bpvp::Plugin::addModelOutput(float const* onsets, float const* frames, float const* contours)
 {
-    static auto constexpr effectiveBlockSize = modelBlockSize - modelBlockPadding;
-    while(mInputBufferPosition >= effectiveBlockSize)
+    mCache.addWindow(onsets, frames, contours, mNumWindowFrames);
+
+    // The windows of the streams are added in turn
+    auto const streamIndex = mNextOutputStream;
+    auto& stream = mStreams[streamIndex];
+    mNextOutputStream = (mNextOutputStream + 1) % mStreams.size();
+
+    // Only the frames of the new samples are kept, the last frames that
+    // analyse the context after the new samples are kept aside in case the
+    // signal ends within them
+    auto const trailingFrame = mNumContextFrames + mNumHopFrames;
+    auto const copyTrailingFrames = [&](float const* data, size_t binCount, std::vector<float>& trailing)
+    {
+        trailing.assign(data + trailingFrame * binCount, data + mNumWindowFrames * binCount);
+    };
+    copyTrailingFrames(onsets, modelNumNotes, stream.trailingFrames.onsets);
+    copyTrailingFrames(frames, modelNumNotes, stream.trailingFrames.frames);
+    if(contours != nullptr)
+    {
+        copyTrailingFrames(contours, modelNumContourBins, stream.trailingFrames.contours);
+    }
+    else
+    {
+        stream.trailingFrames.contours.clear();
+    }
+
+    auto const numFrames = mNumAddedWindows == mFinalWindow ? mNumFinalWindowFrames : mNumHopFrames;
+    if(mNextOutputStream == 0)
     {
-        std::fill(mAudioBuffer.begin(), mAudioBuffer.end(), 0.0f);
-        std::copy(mInputBuffer.cbegin(), std::next(mInputBuffer.cbegin(), effectiveBlockSize), mAudioBuffer.begin());
+        ++mNumAddedWindows;
+    }
+    addOutputFrames(streamIndex, onsets + mNumContextFrames * modelNumNotes, frames + mNumContextFrames * modelNumNotes, contours != nullptr ? contours + mNumContextFrames * modelNumContourBins : nullptr, numFrames);
+}
 
-        TfLiteTensorCopyFromBuffer(TfLiteInterpreterGetInputTensor(mInterpreter.get(), 0), mAudioBuffer.data(), mAudioBuffer.size() * sizeof(float));
-        for(size_t i = effectiveBlockSize; i < mInputBufferPosition; ++i)
+void Bpvp::Plugin::addOutputFrames(size_t streamIndex, float const* onsets, float const* frames, float const* contours, size_t numFrames)
+{
+    auto& stream = mStreams[streamIndex];
+    if(isStreamingNotes())
+    {
+        for(auto& decoder : stream.decoders)
         {
-            mInputBuffer[i - effectiveBlockSize] = mInputBuffer.at(i);
+            decoder.addFrames(frames, onsets, numFrames);
         }
-        mInputBufferPosition -= effectiveBlockSize;
+    }
+    else
+    {
+        auto const numChunks = stream.accumulatedOnsets.getNumChunks() + stream.accumulatedFrames.getNumChunks();
+        // The budget of a posteriorgram is disabled once its chunks cannot
+        // be written, so the failure is only reported once
+        auto const onsetsSpilled = stream.accumulatedOnsets.addFrames(onsets, numFrames);
+        auto const framesSpilled = stream.accumulatedFrames.addFrames(frames, numFrames);
+        if(!onsetsSpilled || !framesSpilled)
+        {
+            BpvpErr("The activations cannot be written to the temporary directory, they are kept in memory");
+        }
+        mProfiler.add(Profiler::Counter::accumulatorChunks, stream.accumulatedOnsets.getNumChunks() + stream.accumulatedFrames.getNumChunks() - numChunks);
+    }
 
-        TfLiteInterpreterInvoke(mInterpreter.get());
+    if(!mDenseOutputs)
+    {
+        return;
+    }
 
-        auto const addFrames = [&](std::vector<std::array<float, modelNumNotes>>& buffer)
+    // The dense outputs concatenate the activations of the streams, so the
+    // frames of a stream are kept until the frames of the last stream are
+    // available
+    if(mStreams.size() > 1)
+    {
+        auto const stageFrames = [&](float const* data, size_t binCount, std::vector<float>& staged)
         {
-            buffer.reserve(buffer.size() + modelNumFrames);
-            auto it = mOuputBuffer.cbegin();
-            while(it != mOuputBuffer.cend())
+            if(data != nullptr)
             {
-                auto const next = std::next(it, modelNumNotes);
-                buffer.push_back({});
-                std::copy(it, next, buffer.back().begin());
-                it = next;
+                staged.assign(data, data + numFrames * binCount);
             }
         };
+        stageFrames(onsets, modelNumNotes, stream.outputFrames.onsets);
+        stageFrames(frames, modelNumNotes, stream.outputFrames.frames);
+        stageFrames(contours, modelNumContourBins, stream.outputFrames.contours);
+        if(streamIndex + 1 < mStreams.size())
+        {
+            return;
+        }
+    }
+
+    // The frames are timestamped at the rate declared by the outputs, the
+    // notes keep the times of the frames in their windows
+    auto const frameRate = static_cast<double>(modelNumValidFrames) / modelBlockDuration;
+    auto const addActivations = [&](int outputIndex, float const* data, std::vector<float> Activations::*member, size_t binCount)
+    {
+        auto& fl = mPendingFeatures[outputIndex];
+        fl.reserve(fl.size() + numFrames);
+        for(size_t frame = 0; frame < numFrames; ++frame)
+        {
+            Feature feature;
+            feature.hasTimestamp = true;
+            feature.timestamp = Vamp::RealTime::fromSeconds(static_cast<double>(mNumOutputFrames + frame) / frameRate);
+            if(mStreams.size() == 1)
+            {
+                feature.values.assign(data + frame * binCount, data + (frame + 1) * binCount);
+            }
+            else
+            {
+                feature.values.reserve(binCount * mStreams.size());
+                for(auto const& frameStream : mStreams)
+                {
+                    auto const* streamData = (frameStream.outputFrames.*member).data() + frame * binCount;
+                    feature.values.insert(feature.values.end(), streamData, streamData + binCount);
+                }
+            }
+            fl.push_back(std::move(feature));
+        }
+    };
+    addActivations(1, onsets, &Activations::onsets, modelNumNotes);
+    addActivations(2, frames, &Activations::frames, modelNumNotes);
+    if(contours != nullptr)
+    {
+        addActivations(3, contours, &Activations::contours, modelNumContourBins);
+    }
+    mNumOutputFrames += numFrames;
+    mProfiler.add(Profiler::Counter::denseFrames, numFrames);
+}
 
-        TfLiteTensorCopyToBuffer(TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 0), mOuputBuffer.data(), mOuputBuffer.size() * sizeof(float));
-        addFrames(mAccumulatedOnsets);
+void Bpvp::Plugin::writeProfile()
+{
+    if(!mProfiler.isEnabled())
+    {
+        return;
+    }
+    auto const accumulatorMemory = std::accumulate(mStreams.cbegin(), mStreams.cend(), static_cast<size_t>(0), [](auto const memory, auto const& stream)
+                                                   {
+                                                       return memory + stream.accumulatedOnsets.getMemorySize() + stream.accumulatedFrames.getMemorySize();
+                                                   });
+    mProfiler.set(Profiler::Counter::accumulatorMemory, accumulatorMemory);
+    auto const write = [this](std::ostream& stream)
+    {
+        stream << "{\"plugin\":\"" << getIdentifier() << "\",\"version\":" << getPluginVersion() << ",\"sample_rate\":" << getInputSampleRate() << ",\"block_size\":" << mBlockSize << ",\"profile\":";
+        mProfiler.write(stream);
+        stream << "}\n";
+    };
+    if(mProfilePath.empty())
+    {
+        write(std::cerr);
+        return;
+    }
+    std::ofstream stream(mProfilePath, std::ios::app);
+    if(!stream.is_open())
+    {
+        BpvpErr("Profile cannot be written to " << mProfilePath);
+        return;
+    }
+    write(stream);
+}
 
-        TfLiteTensorCopyToBuffer(TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 1), mOuputBuffer.data(), mOuputBuffer.size() * sizeof(float));
-        addFrames(mAccumulatedFrames);
+// The previous shape is restored if the model cannot be resized, the callers
+// report the failure
+bool Bpvp::Plugin::resizeModelBatch(size_t numWindows)
+{
+    if(numWindows == mModelBatchSize && mWindowSize == mModelWindowSize)
+    {
+        return true;
+    }
+    auto const* input = TfLiteInterpreterGetInputTensor(mInterpreter.get(), 0);
+    std::vector<int> dims(static_cast<size_t>(TfLiteTensorNumDims(input)));
+    for(size_t index = 0; index < dims.size(); ++index)
+    {
+        dims[index] = TfLiteTensorDim(input, static_cast<int32_t>(index));
+    }
+    auto const resize = [&](size_t batchSize, size_t windowSize)
+    {
+        dims[0] = static_cast<int>(batchSize);
+        dims[1] = static_cast<int>(windowSize);
+        return TfLiteInterpreterResizeInputTensor(mInterpreter.get(), 0, dims.data(), static_cast<int32_t>(dims.size())) == kTfLiteOk && TfLiteInterpreterAllocateTensors(mInterpreter.get()) == kTfLiteOk;
+    };
+    // The number of frames of the outputs must also match the windows
+    auto const* onsets = TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 0);
+    if(!resize(numWindows, mWindowSize) || TfLiteTensorDim(onsets, 1) != static_cast<int32_t>(mNumWindowFrames))
+    {
+        resize(mModelBatchSize, mModelWindowSize);
+        return false;
     }
+    mModelBatchSize = numWindows;
+    mModelWindowSize = mWindowSize;
+    return true;
 }
 
-Bpvp::Plugin::FeatureSet Bpvp::Plugin::process(float const* const* inputBuffers, [[maybe_unused]] Vamp::RealTime timestamp)
+bool Bpvp::Plugin::runModel(float const* audio, size_t numWindows)
+{
+    // The windows already written in the input tensor are only copied when
+    // the tensor must be resized for an incomplete batch
+    auto const* input = TfLiteInterpreterGetInputTensor(mInterpreter.get(), 0);
+    if(audio == TfLiteTensorData(input) && numWindows != mModelBatchSize)
+    {
+        Profiler::Scope scope(mProfiler, Profiler::Stage::copy);
+        std::copy(audio, audio + numWindows * mWindowSize, mAudioBuffer.begin());
+        audio = mAudioBuffer.data();
+    }
+    // If the model cannot be resized, an incomplete batch is padded with
+    // silence in the previous shape of the tensor
+    if(!resizeModelBatch(numWindows) && (mModelWindowSize != mWindowSize || numWindows > mModelBatchSize))
+    {
+        BpvpErr("The model cannot analyse " << numWindows << " windows of " << mWindowSize << " samples");
+        return false;
+    }
+    input = TfLiteInterpreterGetInputTensor(mInterpreter.get(), 0);
+    auto* data = static_cast<float*>(TfLiteTensorData(input));
+    if(data == nullptr)
+    {
+        return false;
+    }
+    if(audio != data)
+    {
+        Profiler::Scope scope(mProfiler, Profiler::Stage::copy);
+        std::copy(audio, audio + numWindows * mWindowSize, data);
+    }
+    std::fill(data + numWindows * mWindowSize, data + mModelBatchSize * mModelWindowSize, 0.0f);
+    // The inference waits until the threads of its interpreter are available
+    // in the budget of the process
+    std::optional<Scheduler::Scope> reservation;
+    {
+        Profiler::Scope scope(mProfiler, Profiler::Stage::scheduling);
+        reservation.emplace(getScheduler(), mInferenceConfig.numThreads);
+    }
+    Profiler::Scope scope(mProfiler, Profiler::Stage::inference);
+    return TfLiteInterpreterInvoke(mInterpreter.get()) == kTfLiteOk;
+}
+
+// Without the background inference, the windows are written directly in the
+// input tensor when it has the size of the batch
+float* Bpvp::Plugin::getBatchData()
+{
+    auto const* input = TfLiteInterpreterGetInputTensor(mInterpreter.get(), 0);
+    if(mModelBatchSize == mBatchSize && mModelWindowSize == mWindowSize && TfLiteTensorType(input) == kTfLiteFloat32 && TfLiteTensorData(input) != nullptr)
+    {
+        return static_cast<float*>(TfLiteTensorData(input));
+    }
+    return mAudioBuffer.data();
+}
+
+float* Bpvp::Plugin::getBatchBuffer()
+{
+    if(!mWorker.joinable())
+    {
+        if(mNumBatchedWindows == 0)
+        {
+            resizeModelBatch(mBatchSize);
+        }
+        return getBatchData() + mNumBatchedWindows * mWindowSize;
+    }
+    // All the slots are in use, so the host thread waits for the oldest one
+    if(mNumBatchedWindows == 0 && mNumSubmittedSlots - mNumCollectedSlots >= mInferenceSlots.size())
+    {
+        auto& slot = *mInferenceSlots.at(mNumCollectedSlots % mInferenceSlots.size());
+        slot.state.wait(InferenceSlot::State::ready, std::memory_order_acquire);
+        collectSlots(false, false);
+    }
+    auto& slot = *mInferenceSlots.at(mNumSubmittedSlots % mInferenceSlots.size());
+    return slot.audio.data() + mNumBatchedWindows * mWindowSize;
+}
+
+void Bpvp::Plugin::processBatch()
+{
+    if(mBatchedWindows.empty())
+    {
+        return;
+    }
+    if(mNumBatchedWindows == 0)
+    {
+        // The batch only has silent windows that follow the submitted slots
+        collectSlots(true, false);
+        addBatchOutput(mBatchedWindows, nullptr, nullptr, nullptr);
+        mBatchedWindows.clear();
+        return;
+    }
+    if(mWorker.joinable())
+    {
+        auto& slot = *mInferenceSlots.at(mNumSubmittedSlots % mInferenceSlots.size());
+        slot.numWindows = mNumBatchedWindows;
+        slot.windows.assign(mBatchedWindows.cbegin(), mBatchedWindows.cend());
+        slot.state.store(InferenceSlot::State::ready, std::memory_order_release);
+        slot.state.notify_one();
+        ++mNumSubmittedSlots;
+        mNumBatchedWindows = 0;
+        mBatchedWindows.clear();
+        collectSlots(false, false);
+        return;
+    }
+
+    // The windows that cannot be analysed have null activations so the next
+    // frames keep their time
+    if(!runModel(getBatchData(), mNumBatchedWindows))
+    {
+        addBatchOutput(mBatchedWindows, nullptr, nullptr, nullptr);
+    }
+    else
+    {
+        auto const* onsets = static_cast<float const*>(TfLiteTensorData(TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 0)));
+        auto const* frames = static_cast<float const*>(TfLiteTensorData(TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 1)));
+        auto const* contours = mHasContours ? static_cast<float const*>(TfLiteTensorData(TfLiteInterpreterGetOutputTensor(mInterpreter.get(), 2))) : nullptr;
+        addBatchOutput(mBatchedWindows, onsets, frames, contours);
+    }
+    mNumBatchedWindows = 0;
+    mBatchedWindows.clear();
+}
+
+void Bpvp::Plugin::addBatchOutput(std::vector<bool> const& windows, float const* onsets, float const* frames, float const* contours)
+{
+    // The silent windows are not analysed and only have null activations,
+    // the analysed windows follow each other in the outputs of the model
+    auto const tensorSize = mNumWindowFrames * modelNumNotes;
+    auto const contourTensorSize = mNumWindowFrames * modelNumContourBins;
+    size_t window = 0;
+    for(auto const isSilentWindow : windows)
+    {
+        if(isSilentWindow || onsets == nullptr)
+        {
+            addModelOutput(getSilentOutput(), getSilentOutput(), mHasContours ? getSilentOutput() : nullptr);
+        }
+        else
+        {
+            addModelOutput(onsets + window * tensorSize, frames + window * tensorSize, contours != nullptr ? contours + window * contourTensorSize : nullptr);
+            ++window;
+        }
+    }
+}
+
+bool Bpvp::Plugin::isSilent(float const* buffer) const
+{
+    if(mSilenceThreshold <= minSilenceThreshold)
+    {
+        return std::all_of(buffer, buffer + mWindowSize, [](auto const sample)
+                           {
+                               return sample == 0.0f;
+                           });
+    }
+    // The peak is also compared so the short transients in a quiet window
+    // are still analysed
+    auto const [peak, meanSquare] = getEnergy(buffer, mWindowSize);
+    auto const threshold = std::pow(10.0f, mSilenceThreshold / 20.0f);
+    auto const peakThreshold = std::pow(10.0f, (mSilenceThreshold + silencePeakMargin) / 20.0f);
+    return meanSquare < threshold * threshold && peak < peakThreshold;
+}
+
+void Bpvp::Plugin::processModel()
+{
+    // The windows overlap by their context, the start of the ring buffers
+    // moves by the hop so the context after the new samples is kept for the
+    // next window without moving the samples
+    while(mInputBufferPosition >= mWindowSize)
+    {
+        for(auto& stream : mStreams)
+        {
+            auto* buffer = getBatchBuffer();
+            readRingBuffer(stream.inputBuffer, mInputBufferStart, mWindowSize, buffer);
+            mProfiler.add(Profiler::Counter::windows);
+            if(auto const window = mCache.getWindow(buffer, mWindowSize, mNumWindowFrames); window.has_value())
+            {
+                mProfiler.add(Profiler::Counter::cachedWindows);
+                addModelOutput(window->onsets, window->frames, window->contours);
+                continue;
+            }
+            if(isSilent(buffer))
+            {
+                // The silent window keeps its place in the batch without being
+                // analysed, so the batch is not broken, its buffer is reused
+                // by the next window
+                mProfiler.add(Profiler::Counter::skippedWindows);
+                if(mBatchedWindows.empty() && mNumCollectedSlots == mNumSubmittedSlots)
+                {
+                    addModelOutput(getSilentOutput(), getSilentOutput(), mHasContours ? getSilentOutput() : nullptr);
+                }
+                else
+                {
+                    mBatchedWindows.push_back(true);
+                }
+                continue;
+            }
+            mBatchedWindows.push_back(false);
+            if(++mNumBatchedWindows >= mBatchSize)
+            {
+                processBatch();
+            }
+        }
+        auto const hopSize = getWindowPosition(mNumQueuedWindows + 1) - getWindowPosition(mNumQueuedWindows);
+        mInputBufferStart = (mInputBufferStart + hopSize) % mStreams.front().inputBuffer.size();
+        mInputBufferPosition -= hopSize;
+        ++mNumQueuedWindows;
+    }
+}
+
+void Bpvp::Plugin::startWorker(size_t numSlots)
+{
+    auto const tensorSize = mNumWindowFrames * modelNumNotes;
+    auto const contourTensorSize = mNumWindowFrames * modelNumContourBins;
+    if(mWorker.joinable() && mInferenceSlots.size() == numSlots && mInferenceSlots.front()->audio.size() == mBatchSize * mWindowSize && mInferenceSlots.front()->onsets.size() == mBatchSize * tensorSize)
+    {
+        return;
+    }
+    stopWorker();
+    mInferenceSlots.clear();
+    for(size_t index = 0; index < numSlots; ++index)
+    {
+        auto slot = std::make_unique<InferenceSlot>();
+        slot->audio.resize(mBatchSize * mWindowSize);
+        slot->onsets.resize(mBatchSize * tensorSize);
+        slot->frames.resize(mBatchSize * tensorSize);
+        slot->contours.resize(mHasContours ? mBatchSize * contourTensorSize : 0);
+        mInferenceSlots.push_back(std::move(slot));
+    }
+    mNumSubmittedSlots = 0;
+    mNumCollectedSlots = 0;
+    mWorker = std::thread(&Plugin::runWorker, this);
+}
+
+void Bpvp::Plugin::stopWorker()
+{
+    if(!mWorker.joinable())
+    {
+        return;
+    }
+    collectSlots(true, true);
+    auto& slot = *mInferenceSlots.at(mNumSubmittedSlots % mInferenceSlots.size());
+    slot.state.store(InferenceSlot::State::stop, std::memory_order_release);
+    slot.state.notify_one();
+    mWorker.join();
+    mInferenceSlots.clear();
+}
+
+void Bpvp::Plugin::runWorker()
+{
+    size_t index = 0;
+    while(true)
+    {
+        // The slot can still hold the output of its previous batch if the
+        // host thread hasn't collected it yet, so the worker waits until the
+        // slot is submitted again
+        auto& slot = *mInferenceSlots.at(index % mInferenceSlots.size());
+        auto state = slot.state.load(std::memory_order_acquire);
+        while(state != InferenceSlot::State::ready && state != InferenceSlot::State::stop)
+        {
+            slot.state.wait(state, std::memory_order_acquire);
+            state = slot.state.load(std::memory_order_acquire);
+        }
+        if(state == InferenceSlot::State::stop)
+        {
+            slot.state.store(InferenceSlot::State::free, std::memory_order_relaxed);
+            return;
+        }
+
+        // The output tensors can be larger than the slot if the batch has
+        // been padded, the activations are null if the inference failed
+        auto const succeeded = runModel(slot.audio.data(), slot.numWindows);
+        Profiler::Scope scope(mProfiler, Profiler::Stage::copy);
+        auto const copyOutput = [&](int32_t index, size_t size, std::vector<float>& output)
+        {
+            auto const* data = static_cast<float const*>(TfLiteTensorData(TfLiteInterpreterGetOutputTensor(mInterpreter.get(), index)));
+            if(succeeded && data != nullptr)
+            {
+                std::copy(data, data + slot.numWindows * size, output.begin());
+            }
+            else
+            {
+                std::fill(output.begin(), std::next(output.begin(), static_cast<long>(slot.numWindows * size)), 0.0f);
+            }
+        };
+        auto const tensorSize = mNumWindowFrames * modelNumNotes;
+        copyOutput(0, tensorSize, slot.onsets);
+        copyOutput(1, tensorSize, slot.frames);
+        if(mHasContours)
+        {
+            copyOutput(2, mNumWindowFrames * modelNumContourBins, slot.contours);
+        }
+
+        slot.state.store(InferenceSlot::State::done, std::memory_order_release);
+        slot.state.notify_one();
+        ++index;
+    }
+}
+
+void Bpvp::Plugin::collectSlots(bool wait, bool discard)
+{
+    while(mNumCollectedSlots < mNumSubmittedSlots)
+    {
+        auto& slot = *mInferenceSlots.at(mNumCollectedSlots % mInferenceSlots.size());
+        if(wait)
+        {
+            slot.state.wait(InferenceSlot::State::ready, std::memory_order_acquire);
+        }
+        if(slot.state.load(std::memory_order_acquire) != InferenceSlot::State::done)
+        {
+            return;
+        }
+        if(!discard)
+        {
+            addBatchOutput(slot.windows, slot.onsets.data(), slot.frames.data(), mHasContours ? slot.contours.data() : nullptr);
+        }
+        slot.state.store(InferenceSlot::State::free, std::memory_order_release);
+        ++mNumCollectedSlots;
+    }
+}
+
+void Bpvp::Plugin::resampleInput(float const* const* inputBuffers, size_t numSamples)
 {
-    auto const* inputBuffer = inputBuffers[0];
+    // The resamplers of the streams are identical so they always consume and
+    // produce the same number of samples, the samples are written until the
+    // end of the ring buffers and the next ones at their beginning
     size_t inputPosition = 0;
-    auto remainingSamples = mBlockSize;
+    auto remainingSamples = numSamples;
+    auto const ringSize = mStreams.front().inputBuffer.size();
     while(remainingSamples > 0)
     {
-        auto const remainingOutput = mInputBuffer.size() - mInputBufferPosition;
-        auto const result = mResampler.process(remainingSamples, inputBuffer + inputPosition, remainingOutput, mInputBuffer.data() + mInputBufferPosition);
+        auto const writePosition = (mInputBufferStart + mInputBufferPosition) % ringSize;
+        auto const remainingOutput = std::min(ringSize - writePosition, ringSize - mInputBufferPosition);
+        std::tuple<size_t, size_t> result;
+        {
+            Profiler::Scope scope(mProfiler, Profiler::Stage::resampling);
+            for(size_t streamIndex = 0; streamIndex < mStreams.size(); ++streamIndex)
+            {
+                auto& stream = mStreams[streamIndex];
+                result = stream.resampler.process(remainingSamples, inputBuffers[streamIndex] + inputPosition, remainingOutput, stream.inputBuffer.data() + writePosition);
+            }
+        }
         mInputBufferPosition += std::get<1>(result);
-        if(mInputBufferPosition >= mInputBuffer.size())
+        if(mInputBufferPosition >= mWindowSize)
         {
             processModel();
         }
         inputPosition += std::get<0>(result);
         remainingSamples -= std::get<0>(result);
     }
-    return {};
+}
+
+Bpvp::Plugin::FeatureSet Bpvp::Plugin::process(float const* const* inputBuffers, [[maybe_unused]] Vamp::RealTime timestamp)
+{
+    mProfiler.add(Profiler::Counter::blocks);
+    // The channels are averaged when they are not analysed separately
+    if(!mMixBuffer.empty())
+    {
+        auto const gain = 1.0f / static_cast<float>(mNumChannels);
+        std::copy(inputBuffers[0], inputBuffers[0] + mBlockSize, mMixBuffer.begin());
+        for(size_t channel = 1; channel < mNumChannels; ++channel)
+        {
+            std::transform(mMixBuffer.cbegin(), mMixBuffer.cend(), inputBuffers[channel], mMixBuffer.begin(), std::plus<float>());
+        }
+        std::transform(mMixBuffer.cbegin(), mMixBuffer.cend(), mMixBuffer.begin(), [&](auto const sample)
+                       {
+                           return sample * gain;
+                       });
+    }
+
+    float const* mixBuffer = mMixBuffer.data();
+    resampleInput(mMixBuffer.empty() ? inputBuffers : &mixBuffer, mBlockSize);
+    collectSlots(false, false);
+    auto features = std::move(mPendingFeatures);
+    mPendingFeatures.clear();
+    if(isStreamingNotes())
+    {
+        Profiler::Scope scope(mProfiler, Profiler::Stage::decoding);
+        for(size_t streamIndex = 0; streamIndex < mStreams.size(); ++streamIndex)
+        {
+            auto& decoders = mStreams[streamIndex].decoders;
+            for(size_t decoderIndex = 0; decoderIndex < decoders.size(); ++decoderIndex)
+            {
+                auto const notes = getNoteFeatures(decoders[decoderIndex].getNotes(false), getChannelTag(streamIndex));
+                if(!notes.empty())
+                {
+                    auto& fl = features[static_cast<int>(getNoteOutputIndex(decoderIndex))];
+                    fl.insert(fl.end(), notes.cbegin(), notes.cend());
+                }
+            }
+        }
+    }
+    return features;
 }
 
 Bpvp::Plugin::FeatureSet Bpvp::Plugin::getRemainingFeatures()
 {
-    if(mInputBufferPosition != 0)
+    static auto constexpr effectiveBlockSize = modelBlockSize - modelBlockPadding;
+    // The resamplers delay their output by half of their kernel, the last
+    // input samples are pushed out with silence
+    if(auto const delay = mStreams.front().resampler.getDelay(); delay > 0)
     {
-        std::fill(std::next(mInputBuffer.begin(), mInputBufferPosition), mInputBuffer.end(), 0.0f);
-        mInputBufferPosition = mInputBuffer.size();
-        processModel();
+        std::vector<float> const silence(delay, 0.0f);
+        std::vector<float const*> const silenceBuffers(mStreams.size(), silence.data());
+        resampleInput(silenceBuffers.data(), delay);
     }
-    if(mAccumulatedFrames.empty() || mAccumulatedOnsets.empty())
+    processModel();
+    auto const contextSize = mNumContextFrames * modelFFTHope;
+    if(mInputBufferPosition > contextSize)
     {
-        return {};
+        auto const numSamples = mInputBufferPosition - contextSize;
+        auto const numFrames = (numSamples * modelNumValidFrames + effectiveBlockSize - 1) / effectiveBlockSize;
+        auto const hopSize = getWindowPosition(mNumQueuedWindows) - getWindowPosition(mNumQueuedWindows - std::min(mNumQueuedWindows, static_cast<size_t>(1)));
+        if(mNumQueuedWindows > 0 && numSamples + contextSize + hopSize <= mWindowSize)
+        {
+            // The remaining samples have already been analysed as the context
+            // of the last window so its last frames are used
+            processBatch();
+            collectSlots(true, false);
+            auto const numTrailingFrames = std::min(numFrames, getNumTrailingFrames());
+            for(size_t streamIndex = 0; streamIndex < mStreams.size(); ++streamIndex)
+            {
+                auto const& trailingFrames = mStreams[streamIndex].trailingFrames;
+                addOutputFrames(streamIndex, trailingFrames.onsets.data(), trailingFrames.frames.data(), trailingFrames.contours.empty() ? nullptr : trailingFrames.contours.data(), numTrailingFrames);
+            }
+        }
+        else
+        {
+            // The last window is shortened to the remaining samples followed
+            // by the context of the model, the layout of the windows is
+            // restored afterwards. If the model cannot be resized, the last
+            // window keeps its size. The window is padded with silence and
+            // only the frames of the remaining samples are kept (including
+            // its right context).
+            auto const numFinalFrames = std::min(numFrames, mNumHopFrames + getNumTrailingFrames());
+            auto const numWindowFrames = mNumContextFrames + numFinalFrames + modelNumTrimmedFrames;
+            auto const layout = std::make_tuple(mWindowSize, mNumWindowFrames, mNumHopFrames, mBatchSize);
+            auto const restoreLayout = [&]()
+            {
+                std::tie(mWindowSize, mNumWindowFrames, mNumHopFrames, mBatchSize) = layout;
+            };
+            if(numWindowFrames < mNumWindowFrames)
+            {
+                processBatch();
+                collectSlots(true, false);
+                mNumWindowFrames = numWindowFrames;
+                mNumHopFrames = numFinalFrames;
+                mWindowSize = modelBlockSize - (modelNumFrames - mNumWindowFrames) * modelFFTHope;
+                mBatchSize = std::min(mStreams.size(), mBatchSize);
+                if(!resizeModelBatch(mBatchSize))
+                {
+                    BpvpDbg("The model cannot analyse the last window of " << mWindowSize << " samples");
+                    restoreLayout();
+                }
+            }
+            for(auto& stream : mStreams)
+            {
+                clearRingBuffer(stream.inputBuffer, (mInputBufferStart + mInputBufferPosition) % stream.inputBuffer.size(), mWindowSize - mInputBufferPosition);
+            }
+            mInputBufferPosition = mWindowSize;
+            mFinalWindow = mNumQueuedWindows;
+            mNumFinalWindowFrames = numFinalFrames;
+            processModel();
+            processBatch();
+            collectSlots(true, false);
+            restoreLayout();
+        }
+        mInputBufferPosition = 0;
     }
-    auto const notes = getNotes(mAccumulatedFrames, mAccumulatedOnsets, true, mVoiceIndex, mFrameThreshold, mOnsetThreshold, static_cast<double>(mMinNoteDuration) / 1000.0, 11, 80.0f, 8000.0f);
-    FeatureList fl;
-    fl.reserve(notes.size());
-    for(auto const& note : notes)
+    processBatch();
+    collectSlots(true, false);
+    mCache.save();
+    auto features = std::move(mPendingFeatures);
+    mPendingFeatures.clear();
     {
-        Feature feature;
-        feature.hasTimestamp = true;
-        feature.timestamp = Vamp::RealTime::fromSeconds(note.start);
-        feature.hasDuration = true;
-        feature.duration = Vamp::RealTime::fromSeconds(note.end) - feature.timestamp;
-        feature.values = {static_cast<float>(note.pitch), static_cast<float>(note.amplitude)};
-        fl.push_back(std::move(feature));
-        feature.hasTimestamp = true;
-        feature.timestamp = Vamp::RealTime::fromSeconds(note.end);
-        feature.hasDuration = true;
-        feature.duration = Vamp::RealTime();
-        feature.values = {};
-        fl.push_back(std::move(feature));
+        // The notes of each stream and each decoder are decoded in parallel
+        // from the same activations, that are only read by the decoders
+        Profiler::Scope scope(mProfiler, Profiler::Stage::decoding);
+        auto const numDecoders = getNumDecoders();
+        for(auto& stream : mStreams)
+        {
+            auto const framesMapped = stream.accumulatedFrames.map();
+            auto const onsetsMapped = stream.accumulatedOnsets.map();
+            if(!framesMapped || !onsetsMapped)
+            {
+                BpvpErr("The activations cannot be read from the temporary directory, the missing activations are silent");
+            }
+        }
+        auto const decode = [&](size_t index)
+        {
+            auto& stream = mStreams[index / numDecoders];
+            auto const decoderIndex = index % numDecoders;
+            if(isStreamingNotes())
+            {
+                return stream.decoders[decoderIndex].getNotes(true);
+            }
+            if(stream.accumulatedFrames.empty() || stream.accumulatedOnsets.empty())
+            {
+                return std::vector<Note>{};
+            }
+            auto const settings = getDecoderSettings(decoderIndex);
+            return getNotes(stream.accumulatedFrames, stream.accumulatedOnsets, settings.inferOnsets, settings.voiceIndex, settings.frameEnergyThreshold, settings.onsetEnergyThreshold, settings.minNoteDuration, settings.maxFramesBelowThreshold, settings.minFreq, settings.maxFreq, settings.melodiaTrick);
+        };
+
+        // The decodings are shared by a number of threads limited by the
+        // share of the thread budget of the instance, the host thread is one
+        // of them
+        std::vector<std::vector<Note>> decodings(mStreams.size() * numDecoders);
+        auto const numThreads = std::min(decodings.size(), getScheduler().getThreadShare());
+        Scheduler::Scope reservation(getScheduler(), numThreads);
+        std::atomic<size_t> nextDecoding{0};
+        auto const runDecodings = [&]()
+        {
+            for(auto index = nextDecoding++; index < decodings.size(); index = nextDecoding++)
+            {
+                decodings[index] = decode(index);
+            }
+        };
+        std::vector<std::future<void>> helpers;
+        for(size_t thread = 1; thread < numThreads; ++thread)
+        {
+            helpers.push_back(std::async(std::launch::async, runDecodings));
+        }
+        runDecodings();
+        for(auto& helper : helpers)
+        {
+            helper.get();
+        }
+        for(size_t index = 0; index < decodings.size(); ++index)
+        {
+            auto const noteFeatures = getNoteFeatures(decodings[index], getChannelTag(index / numDecoders));
+            auto& fl = features[static_cast<int>(getNoteOutputIndex(index % numDecoders))];
+            fl.insert(fl.end(), noteFeatures.cbegin(), noteFeatures.cend());
+        }
     }
-    return {{0, fl}};
+    writeProfile();
+    return features;
 }
 
 #ifdef __cplusplus
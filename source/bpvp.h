@@ -1,11 +1,19 @@
 #pragma once
 
+#include "bpvp_cache.h"
+#include "bpvp_convert.h"
 #include "bpvp_model.h"
+#include "bpvp_profiler.h"
+#include "bpvp_scheduler.h"
 #include <IvePluginAdapter.hpp>
 #include <array>
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <set>
 #include <tensorflow/lite/c/c_api.h>
+#include <thread>
 
 namespace Bpvp
 {
@@ -15,12 +23,14 @@ namespace Bpvp
     {
     public:
         Plugin(float inputSampleRate);
-        ~Plugin() override = default;
+        ~Plugin() override;
 
         // Vamp::Plugin
         bool initialise(size_t channels, size_t stepSize, size_t blockSize) override;
 
         InputDomain getInputDomain() const override;
+        size_t getMinChannelCount() const override;
+        size_t getMaxChannelCount() const override;
 
         std::string getIdentifier() const override;
         std::string getName() const override;
@@ -44,8 +54,96 @@ namespace Bpvp
         // Ive::PluginExtension
         OutputExtraList getOutputExtraDescriptors(size_t outputDescriptorIndex) const override;
 
+        // Changes the sample rate of the input stream so an instance can
+        // analyse several streams (the plugin must be initialised again)
+        void setInputSampleRate(float sampleRate);
+
+        // Profiling
+        Profiler& getProfiler() noexcept;
+
     private:
+        void resampleInput(float const* const* inputBuffers, size_t numSamples);
         void processModel();
+        void processBatch();
+        float* getBatchBuffer();
+        float* getBatchData();
+        bool resizeModelBatch(size_t numWindows);
+        void prepareWindows(size_t numStreams);
+        size_t getWindowPosition(size_t window) const noexcept;
+        size_t getNumTrailingFrames() const noexcept;
+        bool isStreamingNotes() const noexcept;
+        bool runModel(float const* audio, size_t numWindows);
+        bool isSilent(float const* buffer) const;
+        void addModelOutput(float const* onsets, float const* frames, float const* contours);
+        void addOutputFrames(size_t streamIndex, float const* onsets, float const* frames, float const* contours, size_t numFrames);
+        size_t getNumStreams() const noexcept;
+        std::optional<size_t> getChannelTag(size_t streamIndex) const noexcept;
+        void writeProfile();
+        size_t getNumDecoders() const noexcept;
+        size_t getNoteOutputIndex(size_t decoderIndex) const noexcept;
+        Decoder::Settings getDecoderSettings(size_t decoderIndex) const;
+
+        enum class Backend
+        {
+            automatic,
+            builtin,
+            xnnpack,
+            xnnpackFp16
+        };
+
+        enum class Precision
+        {
+            float32,
+            float16,
+            int8
+        };
+
+        struct InferenceConfig
+        {
+            Backend backend{Backend::builtin};
+            size_t numThreads{1};
+
+            bool operator==(InferenceConfig const&) const = default;
+        };
+
+        using interpreter_options_uptr = std::unique_ptr<TfLiteInterpreterOptions, void (*)(TfLiteInterpreterOptions*)>;
+        using delegate_uptr = std::unique_ptr<TfLiteDelegate, std::function<void(TfLiteDelegate*)>>;
+        using interpreter_uptr = std::unique_ptr<TfLiteInterpreter, void (*)(TfLiteInterpreter*)>;
+
+        static std::tuple<void const*, size_t> getModelData(Precision precision);
+        Precision getModelPrecision() const;
+        InferenceConfig getInferenceConfig() const;
+        InferenceConfig tuneInferenceConfig(InferenceConfig const& config) const;
+        bool createInterpreter(InferenceConfig const& config, delegate_uptr& delegate, interpreter_uptr& interpreter) const;
+        bool prepareInterpreter();
+
+        // The inference slots are exchanged between the host thread and the
+        // worker thread without lock, the host thread fills the audio of the
+        // free slots and collects the results of the done slots in order.
+        struct InferenceSlot
+        {
+            enum State : int
+            {
+                free,
+                ready,
+                done,
+                stop
+            };
+
+            std::vector<float> audio;
+            std::vector<float> onsets;
+            std::vector<float> frames;
+            std::vector<float> contours;
+            std::vector<bool> windows;
+            size_t numWindows{0};
+            std::atomic<int> state{State::free};
+        };
+
+        void startWorker(size_t numSlots);
+        void stopWorker();
+        void runWorker();
+        void collectSlots(bool wait, bool discard);
+        void addBatchOutput(std::vector<bool> const& windows, float const* onsets, float const* frames, float const* contours);
 
         class Resampler
         {
@@ -59,31 +157,124 @@ namespace Bpvp
 
             void setTargetSampleRate(double sampleRate) noexcept;
             double getRatio() const noexcept;
+            size_t getDelay() const noexcept;
 
         private:
+            // The exact ratios into the model sample rate use dedicated
+            // filters, the other ratios use a Lagrange interpolation
+            enum class Mode
+            {
+                passThrough,
+                halfBand,
+                polyphase48000,
+                polyphase88200,
+                polyphase96000,
+                lagrange
+            };
+
+            void updateMode() noexcept;
+            template <typename Kernel>
+            std::tuple<size_t, size_t> processKernel(size_t numInputSamples, float const* inputBuffer, size_t numOutputSamples, float* outputBuffer);
+            std::tuple<size_t, size_t> processLagrange(size_t numInputSamples, float const* inputBuffer, size_t numOutputSamples, float* outputBuffer);
+
             double mSourceSampleRate{48000.0};
             double mTargetSampleRate{static_cast<double>(modelSampleRate)};
+            Mode mMode{Mode::lagrange};
             std::array<float, 5> mLastInputSamples;
             double mSubSamplePos{1.0};
             size_t mIndexBuffer{0};
+            std::vector<float> mHistory;
+            size_t mHistoryPosition{0};
+            size_t mPhase{0};
+            size_t mKernelDelay{0};
         };
 
-        using model_uptr = std::unique_ptr<TfLiteModel, void (*)(TfLiteModel*)>;
-        using interpreter_options_uptr = std::unique_ptr<TfLiteInterpreterOptions, void (*)(TfLiteInterpreterOptions*)>;
-        using interpreter_uptr = std::unique_ptr<TfLiteInterpreter, void (*)(TfLiteInterpreter*)>;
-        model_uptr mModel{nullptr, nullptr};
+        std::shared_ptr<TfLiteModel> mModel;
+        Precision mModelPrecision{Precision::float32};
+        std::string mModelPath;
+        void const* mModelData{nullptr};
+        size_t mModelSize{0};
+        delegate_uptr mDelegate{nullptr, nullptr};
         interpreter_uptr mInterpreter{nullptr, nullptr};
-        Resampler mResampler;
-        std::array<float, modelBlockSize * 2> mInputBuffer;
-        std::array<float, modelBlockSize> mAudioBuffer;
-        std::array<float, modelTensorSize> mOuputBuffer;
-        std::vector<std::array<float, modelNumNotes>> mAccumulatedFrames;
-        std::vector<std::array<float, modelNumNotes>> mAccumulatedOnsets;
+        InferenceConfig mInferenceConfig;
+        bool mIsScheduled{false};
+        struct Activations
+        {
+            std::vector<float> onsets;
+            std::vector<float> frames;
+            std::vector<float> contours;
+        };
+
+        // The state of an analysed stream, the channels are either mixed in a
+        // single stream or analysed as separate streams whose windows are
+        // processed in the same batches
+        struct Stream
+        {
+            Resampler resampler;
+            std::vector<float> inputBuffer;
+            Activations trailingFrames;
+            Activations outputFrames;
+            Posteriorgram accumulatedFrames;
+            Posteriorgram accumulatedOnsets;
+            std::vector<Decoder> decoders;
+        };
+
+        std::vector<Stream> mStreams;
+        std::vector<float> mMixBuffer;
+        std::vector<float> mAudioBuffer;
+        std::vector<std::unique_ptr<InferenceSlot>> mInferenceSlots;
+        std::thread mWorker;
+        size_t mNumSubmittedSlots{0};
+        size_t mNumCollectedSlots{0};
+        size_t mNumBatchedWindows{0};
+        std::vector<bool> mBatchedWindows;
+        size_t mModelBatchSize{1};
+        size_t mModelWindowSize{modelBlockSize};
+
+        // The layout of the analysis windows in samples and in frames, the
+        // live mode uses shorter windows than the input of the model
+        bool mIsLive{false};
+        size_t mWindowSize{modelBlockSize};
+        size_t mNumWindowFrames{modelNumFrames};
+        size_t mNumContextFrames{modelNumTrimmedFrames};
+        size_t mNumHopFrames{modelNumValidFrames};
+        size_t mNumLookbackFrames{modelNumFrames * 3};
+        size_t mBatchSize{1};
+        Cache mCache;
+        Profiler mProfiler;
+        std::string mProfilePath;
+        FeatureSet mPendingFeatures;
+        size_t mNumQueuedWindows{0};
+        size_t mNumAddedWindows{0};
+        size_t mNextOutputStream{0};
+        size_t mFinalWindow{0};
+        size_t mNumFinalWindowFrames{modelNumValidFrames};
+        size_t mNumOutputFrames{0};
+        bool mModelHasContours{false};
+        bool mHasContours{false};
+        // The input buffers of the streams are ring buffers, the window
+        // starts at mInputBufferStart and mInputBufferPosition is the number
+        // of samples available from the start
+        size_t mInputBufferStart{0};
         size_t mInputBufferPosition{0};
         size_t mBlockSize{0};
+        size_t mNumChannels{1};
         size_t mVoiceIndex{0};
         float mFrameThreshold{0.7f};
         float mOnsetThreshold{0.5f};
         int mMinNoteDuration{120};
+        float mSilenceThreshold{-120.0f};
+        bool mStreamNotes{false};
+        bool mThresholdPresets{false};
+        bool mDenseOutputs{true};
+        bool mLiveMode{false};
+        float mLiveHop{100.0f};
+        float mLatencyBudget{300.0f};
+        bool mSeparateChannels{false};
+        size_t mBackgroundInference{0};
+        size_t mBackend{static_cast<size_t>(Backend::builtin)};
+        size_t mPrecision{static_cast<size_t>(Precision::float32)};
+        size_t mNumThreads{1};
+        size_t mBatchSizeParameter{1};
     };
 } // namespace Bpvp
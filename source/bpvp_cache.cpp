@@ -0,0 +1,362 @@
+#include "bpvp_cache.h"
+#include "bpvp_posteriorgram.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Bpvp
+{
+    static auto constexpr cacheMagic = std::array<char, 8>{'B', 'P', 'V', 'P', 'C', 'A', 'C', 'H'};
+    static auto constexpr cacheVersion = static_cast<uint32_t>(5);
+
+    uint64_t getHash(void const* data, size_t size, uint64_t seed)
+    {
+        // MurmurHash64A by Austin Appleby (public domain)
+        static auto constexpr m = static_cast<uint64_t>(0xc6a4a7935bd1e995ull);
+        static auto constexpr r = 47;
+        auto const* bytes = static_cast<unsigned char const*>(data);
+        auto hash = seed ^ (static_cast<uint64_t>(size) * m);
+        auto const numWords = size / sizeof(uint64_t);
+        for(size_t index = 0; index < numWords; ++index)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + index * sizeof(uint64_t), sizeof(uint64_t));
+            word *= m;
+            word ^= word >> r;
+            word *= m;
+            hash ^= word;
+            hash *= m;
+        }
+        auto const* tail = bytes + numWords * sizeof(uint64_t);
+        auto const numRemaining = size & 7;
+        if(numRemaining > 0)
+        {
+            for(size_t index = numRemaining; index > 0; --index)
+            {
+                hash ^= static_cast<uint64_t>(tail[index - 1]) << (8 * (index - 1));
+            }
+            hash *= m;
+        }
+        hash ^= hash >> r;
+        hash *= m;
+        hash ^= hash >> r;
+        return hash;
+    }
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    bool MappedFile::open(std::filesystem::path const& path)
+    {
+        close();
+#if defined(_WIN32)
+        auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER size;
+        if(!GetFileSizeEx(file, &size) || size.QuadPart <= 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping == nullptr)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        auto const* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(data == nullptr)
+        {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+        mFile = file;
+        mMapping = mapping;
+        mData = data;
+        mSize = static_cast<size_t>(size.QuadPart);
+#else
+        auto const fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0 || info.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        auto* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(data == MAP_FAILED)
+        {
+            return false;
+        }
+        mData = data;
+        mSize = static_cast<size_t>(info.st_size);
+#endif
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if(mData == nullptr)
+        {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(mData);
+        CloseHandle(mMapping);
+        CloseHandle(mFile);
+        mMapping = nullptr;
+        mFile = nullptr;
+#else
+        munmap(const_cast<void*>(mData), mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    void const* MappedFile::data() const noexcept
+    {
+        return mData;
+    }
+
+    size_t MappedFile::size() const noexcept
+    {
+        return mSize;
+    }
+
+    Cache::~Cache()
+    {
+        stopWriting();
+    }
+
+    void Cache::prepare(std::filesystem::path const& directory, uint64_t modelHash, bool hasContours)
+    {
+        mDirectory = directory;
+        mModelHash = modelHash;
+        mHasContours = hasContours;
+        mRecord.resize(getRecordSize());
+        mOnsets.resize(modelTensorSize);
+        mFrames.resize(modelTensorSize);
+        mContours.resize(hasContours ? modelContourTensorSize : 0);
+        if(!mDirectory.empty())
+        {
+            std::error_code ec;
+            std::filesystem::create_directories(mDirectory, ec);
+            if(ec)
+            {
+                std::cerr << "Bpvp: Cannot create cache directory " << mDirectory << " (" << ec.message() << ")\n";
+                mDirectory.clear();
+            }
+        }
+        reset();
+    }
+
+    void Cache::reset()
+    {
+        stopWriting();
+        mEntry.close();
+        mNumEntryWindows = 0;
+        mWindowHashes.clear();
+        mNumMatchedWindows = 0;
+        mNumAddedWindows = 0;
+    }
+
+    bool Cache::isEnabled() const noexcept
+    {
+        return !mDirectory.empty();
+    }
+
+    size_t Cache::getRecordSize() const noexcept
+    {
+        return sizeof(uint64_t) + sizeof(uint32_t) + 2 * modelTensorSize + (mHasContours ? modelContourTensorSize : 0);
+    }
+
+    std::filesystem::path Cache::getEntryPath(uint64_t firstWindowHash) const
+    {
+        std::ostringstream stream;
+        stream << std::hex << std::setfill('0') << std::setw(16) << mModelHash << "-" << std::setw(16) << firstWindowHash << ".bpvp";
+        return mDirectory / stream.str();
+    }
+
+    std::optional<Cache::Window> Cache::getWindow(float const* audio, size_t numSamples, size_t numFrames)
+    {
+        if(!isEnabled())
+        {
+            return {};
+        }
+        // The size of the samples is part of the hash
+        auto const hash = getHash(audio, numSamples * sizeof(float), mModelHash);
+        auto const index = mWindowHashes.size();
+        mWindowHashes.push_back(hash);
+        if(index == 0 && mEntry.open(getEntryPath(hash)))
+        {
+            Header header;
+            if(mEntry.size() < sizeof(Header))
+            {
+                mEntry.close();
+            }
+            else
+            {
+                std::memcpy(&header, mEntry.data(), sizeof(Header));
+                if(header.magic != cacheMagic || header.version != cacheVersion || header.numFrames != modelNumFrames || header.numNotes != modelNumNotes || header.numContourBins != (mHasContours ? modelNumContourBins : 0) || header.modelHash != mModelHash || mEntry.size() != sizeof(Header) + header.numWindows * getRecordSize())
+                {
+                    mEntry.close();
+                }
+                else
+                {
+                    mNumEntryWindows = static_cast<size_t>(header.numWindows);
+                }
+            }
+        }
+
+        if(mEntry.data() != nullptr && mNumMatchedWindows == index && index < mNumEntryWindows)
+        {
+            auto const* record = static_cast<uint8_t const*>(mEntry.data()) + sizeof(Header) + index * getRecordSize();
+            uint64_t entryHash;
+            uint32_t entryNumFrames;
+            std::memcpy(&entryHash, record, sizeof(uint64_t));
+            std::memcpy(&entryNumFrames, record + sizeof(uint64_t), sizeof(uint32_t));
+            if(entryHash == hash && entryNumFrames == numFrames)
+            {
+                ++mNumMatchedWindows;
+                auto const tensorSize = numFrames * modelNumNotes;
+                auto const contourTensorSize = mHasContours ? numFrames * modelNumContourBins : 0;
+                auto const* onsets = record + sizeof(uint64_t) + sizeof(uint32_t);
+                std::transform(onsets, onsets + tensorSize, mOnsets.begin(), Posteriorgram::dequantize);
+                std::transform(onsets + modelTensorSize, onsets + modelTensorSize + tensorSize, mFrames.begin(), Posteriorgram::dequantize);
+                std::transform(onsets + 2 * modelTensorSize, onsets + 2 * modelTensorSize + contourTensorSize, mContours.begin(), Posteriorgram::dequantize);
+                return Window{mOnsets.data(), mFrames.data(), mHasContours ? mContours.data() : nullptr};
+            }
+        }
+        startWriting();
+        return {};
+    }
+
+    void Cache::startWriting()
+    {
+        if(mStream.is_open() || mTemporaryPath == std::filesystem::path("-"))
+        {
+            return;
+        }
+
+        // The entry is written in a temporary file that is then renamed so
+        // another process never reads a partial entry
+        auto const path = getEntryPath(mWindowHashes.front());
+        mTemporaryPath = path;
+        mTemporaryPath += "." + std::to_string(std::random_device{}()) + ".tmp";
+        mStream.open(mTemporaryPath, std::ios::binary | std::ios::trunc);
+        Header const header{cacheMagic, cacheVersion, static_cast<uint32_t>(modelNumFrames), static_cast<uint32_t>(modelNumNotes), static_cast<uint32_t>(mHasContours ? modelNumContourBins : 0), mModelHash, 0};
+        mStream.write(reinterpret_cast<char const*>(&header), sizeof(Header));
+
+        // The windows that matched the previous entry are copied
+        if(mEntry.data() != nullptr && mNumMatchedWindows > 0)
+        {
+            auto const* records = static_cast<char const*>(mEntry.data()) + sizeof(Header);
+            mStream.write(records, static_cast<std::streamsize>(mNumMatchedWindows * getRecordSize()));
+        }
+        mEntry.close();
+        if(!mStream.good())
+        {
+            std::cerr << "Bpvp: Cannot write cache entry " << mTemporaryPath << "\n";
+            stopWriting();
+            mTemporaryPath = "-";
+        }
+    }
+
+    void Cache::stopWriting()
+    {
+        if(mStream.is_open())
+        {
+            mStream.close();
+            std::error_code ec;
+            std::filesystem::remove(mTemporaryPath, ec);
+        }
+        mTemporaryPath.clear();
+    }
+
+    void Cache::addWindow(float const* onsets, float const* frames, float const* contours, size_t numFrames)
+    {
+        auto const index = mNumAddedWindows++;
+        if(!mStream.is_open() || index < mNumMatchedWindows || index >= mWindowHashes.size())
+        {
+            return;
+        }
+        // The activations of a shorter window are padded with zeros
+        auto const recordNumFrames = static_cast<uint32_t>(numFrames);
+        std::memcpy(mRecord.data(), &mWindowHashes[index], sizeof(uint64_t));
+        std::memcpy(mRecord.data() + sizeof(uint64_t), &recordNumFrames, sizeof(uint32_t));
+        auto* data = mRecord.data() + sizeof(uint64_t) + sizeof(uint32_t);
+        std::fill(data, mRecord.data() + mRecord.size(), static_cast<uint8_t>(0));
+        std::transform(onsets, onsets + numFrames * modelNumNotes, data, Posteriorgram::quantize);
+        std::transform(frames, frames + numFrames * modelNumNotes, data + modelTensorSize, Posteriorgram::quantize);
+        if(mHasContours)
+        {
+            std::transform(contours, contours + numFrames * modelNumContourBins, data + 2 * modelTensorSize, Posteriorgram::quantize);
+        }
+        mStream.write(reinterpret_cast<char const*>(mRecord.data()), static_cast<std::streamsize>(mRecord.size()));
+    }
+
+    void Cache::save()
+    {
+        if(!mStream.is_open())
+        {
+            return;
+        }
+        if(mNumAddedWindows != mWindowHashes.size())
+        {
+            stopWriting();
+            return;
+        }
+        auto const numWindows = static_cast<uint64_t>(mNumAddedWindows);
+        mStream.seekp(static_cast<std::streamoff>(offsetof(Header, numWindows)));
+        mStream.write(reinterpret_cast<char const*>(&numWindows), sizeof(uint64_t));
+        mStream.close();
+        if(mStream.fail())
+        {
+            std::cerr << "Bpvp: Cannot write cache entry " << mTemporaryPath << "\n";
+            std::error_code ec;
+            std::filesystem::remove(mTemporaryPath, ec);
+            mTemporaryPath.clear();
+            return;
+        }
+
+        auto const path = getEntryPath(mWindowHashes.front());
+        std::error_code ec;
+        std::filesystem::rename(mTemporaryPath, path, ec);
+        if(ec)
+        {
+            std::cerr << "Bpvp: Cannot write cache entry " << path << " (" << ec.message() << ")\n";
+            std::filesystem::remove(mTemporaryPath, ec);
+        }
+        mTemporaryPath.clear();
+    }
+} // namespace Bpvp
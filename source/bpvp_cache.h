@@ -0,0 +1,104 @@
+#pragma once
+
+#include "bpvp_model.h"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
+
+namespace Bpvp
+{
+    uint64_t getHash(void const* data, size_t size, uint64_t seed = 0);
+
+    // A read-only memory mapping of a file
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+        MappedFile(MappedFile const&) = delete;
+        MappedFile& operator=(MappedFile const&) = delete;
+
+        bool open(std::filesystem::path const& path);
+        void close();
+
+        void const* data() const noexcept;
+        size_t size() const noexcept;
+
+    private:
+        void const* mData{nullptr};
+        size_t mSize{0};
+#if defined(_WIN32)
+        void* mFile{nullptr};
+        void* mMapping{nullptr};
+#endif
+    };
+
+    // The cache stores the onsets, the frames and optionally the contours of
+    // the model for each analysis window, quantized on 8 bits like the
+    // accumulated activations. The windows are identified by the hash of
+    // their samples and their number of frames (the last window can be
+    // shorter). An entry is identified by the hash of the model and the hash
+    // of the first window, the hashes of the windows are
+    // then compared one after the other, so the cached output of a window is
+    // only used if all the previous windows matched. Once a window doesn't
+    // match, a new entry is written progressively with the outputs of the
+    // windows.
+    class Cache
+    {
+    public:
+        // The dequantized activations of a window, valid until the next one
+        struct Window
+        {
+            float const* onsets;
+            float const* frames;
+            float const* contours;
+        };
+
+        Cache() = default;
+        ~Cache();
+
+        void prepare(std::filesystem::path const& directory, uint64_t modelHash, bool hasContours);
+        void reset();
+        bool isEnabled() const noexcept;
+
+        std::optional<Window> getWindow(float const* audio, size_t numSamples, size_t numFrames);
+        void addWindow(float const* onsets, float const* frames, float const* contours, size_t numFrames);
+        void save();
+
+    private:
+        struct Header
+        {
+            std::array<char, 8> magic;
+            uint32_t version;
+            uint32_t numFrames;
+            uint32_t numNotes;
+            uint32_t numContourBins;
+            uint64_t modelHash;
+            uint64_t numWindows;
+        };
+
+        size_t getRecordSize() const noexcept;
+
+        std::filesystem::path getEntryPath(uint64_t firstWindowHash) const;
+        void startWriting();
+        void stopWriting();
+
+        std::filesystem::path mDirectory;
+        uint64_t mModelHash{0};
+        bool mHasContours{false};
+        MappedFile mEntry;
+        size_t mNumEntryWindows{0};
+        std::vector<uint64_t> mWindowHashes;
+        size_t mNumMatchedWindows{0};
+        size_t mNumAddedWindows{0};
+        std::filesystem::path mTemporaryPath;
+        std::ofstream mStream;
+        std::vector<uint8_t> mRecord;
+        std::vector<float> mOnsets;
+        std::vector<float> mFrames;
+        std::vector<float> mContours;
+    };
+} // namespace Bpvp
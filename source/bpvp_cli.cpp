@@ -0,0 +1,508 @@
+#include "bpvp.h"
+#include "bpvp_wave.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The command line tool transcribes WAVE files with the plugin without a
+// Vamp host. The files are distributed over a pool of workers, each worker
+// owns a plugin instance (and so an interpreter) that is reused for all its
+// files while the model is shared by the process.
+//
+// Usage: bpvp_cli [options] file.wav...
+//   -o, --output directory          the output directory (the directory of each file by default)
+//   -f, --format csv|midi           the output format (csv by default)
+//   -j, --jobs number               the number of workers (the number of cores by default)
+//   -b, --blocksize number          the number of samples per block (16384 by default)
+//   -p, --parameter identifier=value a parameter of the plugin
+
+namespace
+{
+    enum class Format
+    {
+        csv,
+        midi
+    };
+
+    struct Options
+    {
+        std::vector<std::filesystem::path> inputs;
+        std::filesystem::path outputDirectory;
+        Format format{Format::csv};
+        size_t numJobs{0};
+        size_t blockSize{16384};
+        std::vector<std::pair<std::string, float>> parameters;
+    };
+
+    struct Note
+    {
+        double start;
+        double end;
+        int pitch;
+        int velocity;
+        std::optional<int> channel;
+    };
+
+    // The tasks are distributed in turn over the queues of the workers, a
+    // worker takes the next task at the front of its own queue and steals
+    // the last task of the other queues once its queue is empty
+    class WorkStealingQueue
+    {
+    public:
+        WorkStealingQueue(size_t numWorkers, size_t numTasks)
+        : mQueues(numWorkers)
+        {
+            for(size_t task = 0; task < numTasks; ++task)
+            {
+                mQueues[task % numWorkers].tasks.push_back(task);
+            }
+        }
+
+        std::optional<size_t> pop(size_t worker)
+        {
+            {
+                auto& queue = mQueues[worker];
+                std::scoped_lock lock(queue.mutex);
+                if(!queue.tasks.empty())
+                {
+                    auto const task = queue.tasks.front();
+                    queue.tasks.pop_front();
+                    return task;
+                }
+            }
+            for(size_t offset = 1; offset < mQueues.size(); ++offset)
+            {
+                auto& queue = mQueues[(worker + offset) % mQueues.size()];
+                std::scoped_lock lock(queue.mutex);
+                if(!queue.tasks.empty())
+                {
+                    auto const task = queue.tasks.back();
+                    queue.tasks.pop_back();
+                    return task;
+                }
+            }
+            return {};
+        }
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        std::vector<Queue> mQueues;
+    };
+
+    std::vector<Note> getNotes(Vamp::Plugin::FeatureList const& features)
+    {
+        std::vector<Note> notes;
+        for(auto const& feature : features)
+        {
+            // The features without values mark the end of the notes
+            if(feature.values.size() < 2)
+            {
+                continue;
+            }
+            auto const start = static_cast<double>(feature.timestamp.sec) + static_cast<double>(feature.timestamp.nsec) * 1e-9;
+            auto const duration = static_cast<double>(feature.duration.sec) + static_cast<double>(feature.duration.nsec) * 1e-9;
+            auto const pitch = static_cast<int>(std::round(69.0 + 12.0 * std::log2(static_cast<double>(feature.values[0]) / 440.0)));
+            auto const velocity = static_cast<int>(std::round(std::clamp(feature.values[1], 0.0f, 1.0f) * 127.0f));
+            // The channel is only defined when the channels are analysed
+            // separately
+            auto const channel = feature.values.size() > 2 ? std::optional<int>(static_cast<int>(feature.values[2])) : std::optional<int>();
+            notes.push_back({start, start + duration, std::clamp(pitch, 0, 127), std::clamp(velocity, 1, 127), channel});
+        }
+        return notes;
+    }
+
+    bool writeCsv(std::filesystem::path const& path, std::vector<Note> const& notes)
+    {
+        std::ofstream stream(path);
+        if(!stream.is_open())
+        {
+            return false;
+        }
+        auto const hasChannels = std::any_of(notes.cbegin(), notes.cend(), [](auto const& note)
+                                             {
+                                                 return note.channel.has_value();
+                                             });
+        stream << "start_time_s,end_time_s,pitch_midi,velocity" << (hasChannels ? ",channel" : "") << "\n";
+        stream << std::fixed << std::setprecision(6);
+        for(auto const& note : notes)
+        {
+            stream << note.start << "," << note.end << "," << note.pitch << "," << note.velocity;
+            if(hasChannels)
+            {
+                stream << "," << note.channel.value_or(0);
+            }
+            stream << "\n";
+        }
+        return stream.good();
+    }
+
+    // Writes a standard MIDI file of type 0 at 120 BPM with 480 ticks per
+    // quarter note, the channels of the audio are mapped to the MIDI channels
+    // (the channels beyond the 16th are rejected by the transcription)
+    bool writeMidi(std::filesystem::path const& path, std::vector<Note> const& notes)
+    {
+        static auto constexpr ticksPerQuarter = 480;
+        static auto constexpr microsecondsPerQuarter = 500000;
+        static auto constexpr ticksPerSecond = static_cast<double>(ticksPerQuarter) * 1e6 / static_cast<double>(microsecondsPerQuarter);
+
+        struct Event
+        {
+            uint32_t tick;
+            unsigned char status;
+            unsigned char pitch;
+            unsigned char velocity;
+        };
+        std::vector<Event> events;
+        events.reserve(notes.size() * 2);
+        for(auto const& note : notes)
+        {
+            auto const start = static_cast<uint32_t>(std::llround(note.start * ticksPerSecond));
+            auto const end = std::max(static_cast<uint32_t>(std::llround(note.end * ticksPerSecond)), start + 1);
+            auto const channel = static_cast<unsigned char>(std::clamp(note.channel.value_or(0), 0, 15));
+            events.push_back({start, static_cast<unsigned char>(0x90 | channel), static_cast<unsigned char>(note.pitch), static_cast<unsigned char>(note.velocity)});
+            events.push_back({end, static_cast<unsigned char>(0x80 | channel), static_cast<unsigned char>(note.pitch), 0});
+        }
+        // The note offs are placed before the note ons at the same tick
+        std::stable_sort(events.begin(), events.end(), [](auto const& lhs, auto const& rhs)
+                         {
+                             return lhs.tick < rhs.tick || (lhs.tick == rhs.tick && (lhs.status & 0xF0) < (rhs.status & 0xF0));
+                         });
+
+        std::string track;
+        auto const writeVariableLength = [&](uint32_t value)
+        {
+            std::array<unsigned char, 5> bytes;
+            size_t size = 0;
+            bytes[size++] = static_cast<unsigned char>(value & 0x7F);
+            while((value >>= 7) > 0)
+            {
+                bytes[size++] = static_cast<unsigned char>((value & 0x7F) | 0x80);
+            }
+            while(size > 0)
+            {
+                track.push_back(static_cast<char>(bytes[--size]));
+            }
+        };
+        writeVariableLength(0);
+        track.append("\xFF\x51\x03", 3);
+        track.push_back(static_cast<char>((microsecondsPerQuarter >> 16) & 0xFF));
+        track.push_back(static_cast<char>((microsecondsPerQuarter >> 8) & 0xFF));
+        track.push_back(static_cast<char>(microsecondsPerQuarter & 0xFF));
+        uint32_t tick = 0;
+        for(auto const& event : events)
+        {
+            writeVariableLength(event.tick - tick);
+            tick = event.tick;
+            track.push_back(static_cast<char>(event.status));
+            track.push_back(static_cast<char>(event.pitch));
+            track.push_back(static_cast<char>(event.velocity));
+        }
+        writeVariableLength(0);
+        track.append("\xFF\x2F\x00", 3);
+
+        std::ofstream stream(path, std::ios::binary);
+        if(!stream.is_open())
+        {
+            return false;
+        }
+        auto const writeUint32 = [&](uint32_t value)
+        {
+            char const bytes[] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8), static_cast<char>(value)};
+            stream.write(bytes, sizeof(bytes));
+        };
+        stream.write("MThd", 4);
+        writeUint32(6);
+        char const header[] = {0, 0, 0, 1, static_cast<char>(ticksPerQuarter >> 8), static_cast<char>(ticksPerQuarter & 0xFF)};
+        stream.write(header, sizeof(header));
+        stream.write("MTrk", 4);
+        writeUint32(static_cast<uint32_t>(track.size()));
+        stream.write(track.data(), static_cast<std::streamsize>(track.size()));
+        return stream.good();
+    }
+
+    bool transcribe(Bpvp::Plugin& plugin, Options const& options, std::filesystem::path const& input, std::string& message)
+    {
+        Bpvp::WaveFile file;
+        std::string error;
+        if(!file.open(input, error))
+        {
+            message = error;
+            return false;
+        }
+
+        // The plugin is initialised for each file since the sample rate can
+        // change, the interpreter is kept as long as the inference
+        // configuration doesn't change. The channels are passed to the
+        // plugin that mixes them or analyses them separately, the files
+        // with more channels than supported are mixed beforehand.
+        plugin.setInputSampleRate(static_cast<float>(file.getSampleRate()));
+        for(auto const& parameter : options.parameters)
+        {
+            plugin.setParameter(parameter.first, parameter.second);
+        }
+        // Only the notes are written so the dense outputs are skipped
+        plugin.setParameter("denseoutputs", 0.0f);
+        auto const numChannels = file.getNumChannels() <= plugin.getMaxChannelCount() ? file.getNumChannels() : static_cast<size_t>(1);
+        if(options.format == Format::midi && numChannels > 16 && plugin.getParameter("channelmode") > 0.5f)
+        {
+            message = "the separate channels beyond the 16th cannot be written as MIDI";
+            return false;
+        }
+        if(!plugin.initialise(numChannels, options.blockSize, options.blockSize))
+        {
+            message = "the plugin cannot be initialised";
+            return false;
+        }
+
+        std::vector<std::vector<float>> buffers(numChannels, std::vector<float>(options.blockSize));
+        std::vector<float*> channels;
+        for(auto& buffer : buffers)
+        {
+            channels.push_back(buffer.data());
+        }
+        Vamp::Plugin::FeatureList features;
+        auto const addFeatures = [&](Vamp::Plugin::FeatureSet&& featureSet)
+        {
+            if(auto it = featureSet.find(0); it != featureSet.end())
+            {
+                features.insert(features.end(), std::make_move_iterator(it->second.begin()), std::make_move_iterator(it->second.end()));
+            }
+        };
+        auto const sampleRate = static_cast<unsigned int>(std::round(file.getSampleRate()));
+        for(size_t position = 0; position < file.getNumFrames(); position += options.blockSize)
+        {
+            if(numChannels == file.getNumChannels())
+            {
+                file.read(position, options.blockSize, channels.data());
+            }
+            else
+            {
+                file.readMix(position, options.blockSize, channels.front());
+            }
+            addFeatures(plugin.process(channels.data(), Vamp::RealTime::frame2RealTime(static_cast<long>(position), sampleRate)));
+        }
+        addFeatures(plugin.getRemainingFeatures());
+        auto const notes = getNotes(features);
+
+        auto const outputDirectory = options.outputDirectory.empty() ? input.parent_path() : options.outputDirectory;
+        auto output = outputDirectory / input.filename();
+        output.replace_extension(options.format == Format::csv ? ".csv" : ".mid");
+        if(!(options.format == Format::csv ? writeCsv(output, notes) : writeMidi(output, notes)))
+        {
+            message = "cannot write " + output.string();
+            return false;
+        }
+        message = std::to_string(notes.size()) + " notes in " + output.string();
+        return true;
+    }
+
+    // Parses a positive integer that fills the whole argument
+    std::optional<size_t> parseSize(std::string const& text)
+    {
+        size_t value = 0;
+        auto const end = text.data() + text.size();
+        auto const result = std::from_chars(text.data(), end, value);
+        if(result.ec != std::errc() || result.ptr != end || value == 0)
+        {
+            return {};
+        }
+        return value;
+    }
+
+    // Parses a finite number that fills the whole argument
+    std::optional<float> parseFloat(std::string const& text)
+    {
+        try
+        {
+            size_t position = 0;
+            auto const value = std::stof(text, &position);
+            if(position != text.size() || !std::isfinite(value))
+            {
+                return {};
+            }
+            return value;
+        }
+        catch(std::exception const&)
+        {
+            return {};
+        }
+    }
+
+    void printUsage()
+    {
+        std::cerr << "Usage: bpvp_cli [options] file.wav...\n";
+        std::cerr << "  -o, --output directory           the output directory (the directory of each file by default)\n";
+        std::cerr << "  -f, --format csv|midi            the output format (csv by default)\n";
+        std::cerr << "  -j, --jobs number                the number of workers (the number of cores by default)\n";
+        std::cerr << "  -b, --blocksize number           the number of samples per block (16384 by default)\n";
+        std::cerr << "  -p, --parameter identifier=value a parameter of the plugin\n";
+    }
+
+    std::optional<Options> parseOptions(int argc, char* argv[])
+    {
+        Options options;
+        for(auto index = 1; index < argc; ++index)
+        {
+            std::string const argument = argv[index];
+            auto const hasValue = index + 1 < argc;
+            if((argument == "-o" || argument == "--output") && hasValue)
+            {
+                options.outputDirectory = argv[++index];
+            }
+            else if((argument == "-f" || argument == "--format") && hasValue)
+            {
+                std::string const format = argv[++index];
+                if(format != "csv" && format != "midi")
+                {
+                    std::cerr << "bpvp_cli: invalid format " << format << "\n";
+                    return {};
+                }
+                options.format = format == "csv" ? Format::csv : Format::midi;
+            }
+            else if((argument == "-j" || argument == "--jobs") && hasValue)
+            {
+                auto const numJobs = parseSize(argv[++index]);
+                if(!numJobs.has_value())
+                {
+                    std::cerr << "bpvp_cli: invalid number of jobs " << argv[index] << "\n";
+                    return {};
+                }
+                options.numJobs = numJobs.value();
+            }
+            else if((argument == "-b" || argument == "--blocksize") && hasValue)
+            {
+                auto const blockSize = parseSize(argv[++index]);
+                if(!blockSize.has_value())
+                {
+                    std::cerr << "bpvp_cli: invalid block size " << argv[index] << "\n";
+                    return {};
+                }
+                options.blockSize = blockSize.value();
+            }
+            else if((argument == "-p" || argument == "--parameter") && hasValue)
+            {
+                std::string const parameter = argv[++index];
+                auto const separator = parameter.find('=');
+                auto const value = separator == std::string::npos ? std::optional<float>() : parseFloat(parameter.substr(separator + 1));
+                if(!value.has_value())
+                {
+                    std::cerr << "bpvp_cli: invalid parameter " << parameter << "\n";
+                    return {};
+                }
+                options.parameters.emplace_back(parameter.substr(0, separator), value.value());
+            }
+            else if(!argument.empty() && argument.front() == '-')
+            {
+                return {};
+            }
+            else
+            {
+                options.inputs.emplace_back(argument);
+            }
+        }
+        if(options.inputs.empty())
+        {
+            return {};
+        }
+        return options;
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    auto options = parseOptions(argc, argv);
+    if(!options.has_value())
+    {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    if(!options->outputDirectory.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(options->outputDirectory, ec);
+        if(ec)
+        {
+            std::cerr << "bpvp_cli: cannot create " << options->outputDirectory << " (" << ec.message() << ")\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The largest files are queued first so the workers end at about the
+    // same time
+    std::vector<std::filesystem::path> inputs = options->inputs;
+    std::vector<uintmax_t> sizes;
+    for(auto const& input : inputs)
+    {
+        std::error_code ec;
+        auto const size = std::filesystem::file_size(input, ec);
+        sizes.push_back(ec ? 0 : size);
+    }
+    std::vector<size_t> order(inputs.size());
+    std::iota(order.begin(), order.end(), static_cast<size_t>(0));
+    std::stable_sort(order.begin(), order.end(), [&](auto const lhs, auto const rhs)
+                     {
+                         return sizes[lhs] > sizes[rhs];
+                     });
+
+    auto const numCores = std::max(static_cast<size_t>(std::thread::hardware_concurrency()), static_cast<size_t>(1));
+    auto const numWorkers = std::min(options->numJobs > 0 ? options->numJobs : numCores, inputs.size());
+    WorkStealingQueue queue(numWorkers, inputs.size());
+    std::mutex outputMutex;
+    std::atomic<size_t> numFailures{0};
+    auto const start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for(size_t worker = 0; worker < numWorkers; ++worker)
+    {
+        workers.emplace_back([&, worker]()
+                             {
+                                 std::unique_ptr<Bpvp::Plugin> plugin;
+                                 while(auto const task = queue.pop(worker))
+                                 {
+                                     auto const& input = inputs[order[task.value()]];
+                                     if(plugin == nullptr)
+                                     {
+                                         plugin = std::make_unique<Bpvp::Plugin>(44100.0f);
+                                     }
+                                     std::string message;
+                                     auto const result = transcribe(*plugin.get(), *options, input, message);
+                                     if(!result)
+                                     {
+                                         ++numFailures;
+                                     }
+                                     std::scoped_lock lock(outputMutex);
+                                     (result ? std::cout : std::cerr) << input.string() << ": " << message << "\n";
+                                 }
+                             });
+    }
+    for(auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    auto const duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << inputs.size() - numFailures.load() << " files transcribed with " << numWorkers << " workers in " << duration << " seconds\n";
+    return numFailures.load() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
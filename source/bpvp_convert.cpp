@@ -1,6 +1,7 @@
 #include "bpvp_convert.h"
 #include "bpvp_model.h"
 #include <algorithm>
+#include <bitset>
 #include <cassert>
 #include <iostream>
 
@@ -16,141 +17,452 @@ namespace Bpvp
         return 440.0f * std::pow(2.0, (midi - 69.0f) / 12.0f);
     }
 
-    static constexpr double frameToSeconds(auto frame)
+    // The valid frames of a window are spaced by the hop of the model but
+    // each window starts at its first new sample (the hop of the windows is
+    // not a multiple of the hop of the model)
+    static constexpr double frameToSeconds(size_t frame)
     {
-        return static_cast<double>(frame) / static_cast<double>(modelNumFrames) * modelBlockDuration + 0.1751664994f;
+        auto const window = frame / static_cast<size_t>(modelNumValidFrames);
+        auto const index = frame % static_cast<size_t>(modelNumValidFrames);
+        return static_cast<double>(window * static_cast<size_t>(modelBlockSize - modelBlockPadding) + index * static_cast<size_t>(modelFFTHope)) / static_cast<double>(modelSampleRate);
     }
 
     static constexpr long secondsToFrame(auto seconds)
     {
-        return static_cast<long>(std::ceil((seconds) / modelBlockDuration * static_cast<double>(modelNumFrames)));
+        return static_cast<long>(std::ceil((seconds) / modelBlockDuration * static_cast<double>(modelNumValidFrames)));
     }
 
-    static std::vector<std::array<float, modelNumNotes>> getInferredOnsets(std::vector<std::array<float, modelNumNotes>> const& onsets, std::vector<std::array<float, modelNumNotes>> const& frames, size_t numDiff = 2)
+    static auto constexpr numOnsetsDiff = static_cast<size_t>(2);
+
+    struct FrameNote
+    {
+        size_t start;
+        size_t end;
+        size_t index;
+        float amplitude;
+    };
+
+    static Note toNote(FrameNote const& note, size_t frameOffset)
+    {
+        return {frameToSeconds(note.start + frameOffset), frameToSeconds(note.end + frameOffset), midiToHertz(static_cast<float>(note.index + modelNoteOffset)), note.amplitude};
+    }
+
+    using Activations = std::vector<std::array<float, modelNumNotes>>;
+
+    // The onsets inferred from the differences of the frames of a window
+    struct ScaledOnsetsView
+    {
+        Activations const& onsets;
+        Activations const& notesDiff;
+        float ratio;
+    };
+
+    // The onsets inferred from the differences of the frames of a
+    // posteriorgram, the differences are computed when read
+    struct InferredOnsetsView
+    {
+        PosteriorgramView const& onsets;
+        PosteriorgramView const& frames;
+        float ratio;
+    };
+
+    static float getValue(Activations const& activations, size_t frame, size_t note)
+    {
+        return activations[frame][note];
+    }
+
+    static float getValue(PosteriorgramView const& activations, size_t frame, size_t note)
+    {
+        return activations.get(frame, note);
+    }
+
+    static float getValue(ScaledOnsetsView const& activations, size_t frame, size_t note)
+    {
+        return std::max(activations.onsets[frame][note], activations.notesDiff[frame][note] * activations.ratio);
+    }
+
+    // Reads the activations of a note for a block of frames, the blocks of
+    // the posteriorgrams are aligned on the chunks
+    template <typename Activations>
+    static void readNote(Activations const& activations, size_t note, size_t startFrame, size_t numFrames, float* output)
+    {
+        for(size_t frame = 0; frame < numFrames; ++frame)
+        {
+            output[frame] = getValue(activations, startFrame + frame, note);
+        }
+    }
+
+    static void readNote(PosteriorgramView const& activations, size_t note, size_t startFrame, size_t numFrames, float* output)
+    {
+        assert(startFrame % Posteriorgram::chunkNumFrames == 0 && numFrames <= Posteriorgram::chunkNumFrames);
+        auto const* data = activations.getChunkData(startFrame / Posteriorgram::chunkNumFrames, note);
+        std::transform(data, data + numFrames, output, Posteriorgram::dequantize);
+    }
+
+    static void readNote(InferredOnsetsView const& activations, size_t note, size_t startFrame, size_t numFrames, float* output)
     {
-        std::vector<std::array<float, modelNumNotes>> notesDiff;
-        notesDiff.resize(frames.size());
-        for(auto& notes : notesDiff)
+        assert(startFrame % Posteriorgram::chunkNumFrames == 0 && numFrames <= Posteriorgram::chunkNumFrames);
+        auto const chunk = startFrame / Posteriorgram::chunkNumFrames;
+        auto const* onsetData = activations.onsets.getChunkData(chunk, note);
+        auto const* frameData = activations.frames.getChunkData(chunk, note);
+        auto const ratio = activations.ratio;
+        auto const getOnset = [&](uint8_t onset, uint8_t current, uint8_t previous)
+        {
+            auto const diff = std::max(static_cast<int>(current) - static_cast<int>(previous), 0);
+            return std::max(Posteriorgram::dequantize(onset), Posteriorgram::dequantize(static_cast<uint8_t>(diff)) * ratio);
+        };
+
+        // The first frames of the chunk depend on the previous chunk
+        auto const numHeadFrames = std::min(numOnsetsDiff, numFrames);
+        for(size_t frame = 0; frame < numHeadFrames; ++frame)
+        {
+            auto const globalFrame = startFrame + frame;
+            if(globalFrame < numOnsetsDiff)
+            {
+                output[frame] = Posteriorgram::dequantize(onsetData[frame]);
+            }
+            else
+            {
+                auto const previous = std::max(Posteriorgram::quantize(activations.frames.get(globalFrame - 1, note)), Posteriorgram::quantize(activations.frames.get(globalFrame - 2, note)));
+                output[frame] = getOnset(onsetData[frame], frameData[frame], previous);
+            }
+        }
+        for(size_t frame = numHeadFrames; frame < numFrames; ++frame)
         {
-            std::fill(notes.begin(), notes.end(), 1.0f);
+            output[frame] = getOnset(onsetData[frame], frameData[frame], std::max(frameData[frame - 1], frameData[frame - 2]));
         }
+    }
 
+    template <typename Frames>
+    static float getNotesDiff(Frames const& frames, size_t frame, size_t frameOffset, std::array<float, modelNumNotes>& notesDiff)
+    {
+        std::fill(notesDiff.begin(), notesDiff.end(), 1.0f);
         auto maxDiff = 0.0f;
-        auto maxOnset = 0.0f;
-        for(size_t diff = 1; diff <= numDiff; ++diff)
+        for(size_t diff = 1; diff <= numOnsetsDiff; ++diff)
         {
-            for(size_t frame = 0; frame < frames.size(); ++frame)
+            for(size_t note = 0; note < modelNumNotes; ++note)
             {
-                for(size_t note = 0; note < modelNumNotes; ++note)
-                {
-                    auto const currentEnergy = frames.at(frame).at(note);
-                    auto const previousEnergy = (frame >= diff) ? frames.at(frame - diff).at(note) : 0.0f;
-                    auto const diffEnergy = std::max(currentEnergy - previousEnergy, 0.0f);
-                    notesDiff[frame][note] = std::min((frame >= numDiff) ? diffEnergy : 0.0f, notesDiff.at(frame).at(note));
+                auto const currentEnergy = getValue(frames, frame, note);
+                auto const previousEnergy = (frame >= diff) ? getValue(frames, frame - diff, note) : 0.0f;
+                auto const diffEnergy = std::max(currentEnergy - previousEnergy, 0.0f);
+                notesDiff[note] = std::min((frame + frameOffset >= numOnsetsDiff) ? diffEnergy : 0.0f, notesDiff[note]);
+                maxDiff = std::max(notesDiff[note], maxDiff);
+            }
+        }
+        return maxDiff;
+    }
+
+    static float getInferredOnsetsRatio(float maxOnset, float maxDiff)
+    {
+        return maxDiff >= 0.0f ? maxOnset / maxDiff : 0.0f;
+    }
+
+    static uint8_t getMaximum(uint8_t const* data, size_t size)
+    {
+        uint8_t maximum = 0;
+        for(size_t index = 0; index < size; ++index)
+        {
+            maximum = std::max(data[index], maximum);
+        }
+        return maximum;
+    }
+
+    // The maximum positive difference with the two previous values (the
+    // first two values are only used as previous values)
+    static uint8_t getMaximumDiff(uint8_t const* data, size_t size)
+    {
+        auto maximum = 0;
+        for(size_t index = numOnsetsDiff; index < size; ++index)
+        {
+            auto const previous = std::max(data[index - 1], data[index - 2]);
+            maximum = std::max(static_cast<int>(data[index]) - static_cast<int>(previous), maximum);
+        }
+        return static_cast<uint8_t>(maximum);
+    }
+
+    // The maxima of the onsets and of the differences of the frames are
+    // computed in a single pass over the contiguous frames of each note
+    // (the quantized values are compared as integers)
+    static float getInferredOnsetsRatio(PosteriorgramView const& onsets, PosteriorgramView const& frames)
+    {
+        uint8_t maxOnset = 0;
+        uint8_t maxDiff = 0;
+        auto const numFrames = frames.size();
+        for(size_t chunk = 0; chunk < frames.getNumChunks(); ++chunk)
+        {
+            auto const chunkStart = chunk * Posteriorgram::chunkNumFrames;
+            auto const chunkSize = std::min(Posteriorgram::chunkNumFrames, numFrames - chunkStart);
+            for(size_t note = 0; note < modelNumNotes; ++note)
+            {
+                auto const* frameData = frames.getChunkData(chunk, note);
+                maxOnset = std::max(getMaximum(onsets.getChunkData(chunk, note), chunkSize), maxOnset);
+                maxDiff = std::max(getMaximumDiff(frameData, chunkSize), maxDiff);
 
-                    maxOnset = std::max(onsets.at(frame).at(note), maxOnset);
-                    maxDiff = std::max(notesDiff.at(frame).at(note), maxDiff);
+                // The first frames of the chunk depend on the previous chunk
+                if(chunkStart > 0)
+                {
+                    std::array<uint8_t, numOnsetsDiff * 2> junction;
+                    auto const* previousData = frames.getChunkData(chunk - 1, note);
+                    std::copy(previousData + Posteriorgram::chunkNumFrames - numOnsetsDiff, previousData + Posteriorgram::chunkNumFrames, junction.begin());
+                    auto const numJunctionFrames = std::min(numOnsetsDiff, chunkSize);
+                    std::copy(frameData, frameData + numJunctionFrames, std::next(junction.begin(), numOnsetsDiff));
+                    maxDiff = std::max(getMaximumDiff(junction.data(), numOnsetsDiff + numJunctionFrames), maxDiff);
                 }
             }
         }
+        return getInferredOnsetsRatio(Posteriorgram::dequantize(maxOnset), Posteriorgram::dequantize(maxDiff));
+    }
 
-        auto const ratio = maxDiff >= 0.0f ? maxOnset / maxDiff : 0.0f;
-        for(size_t frame = 0; frame < frames.size(); ++frame)
+    // The frames of a block where the energy of the notes is above the
+    // threshold
+    template <typename Frames>
+    static void getActiveFrames(Frames const& frames, float threshold, size_t startFrame, size_t numFrames, std::vector<std::bitset<modelNumNotes>>& activeFrames)
+    {
+        for(size_t frame = 0; frame < numFrames; ++frame)
         {
-            std::transform(onsets.at(frame).cbegin(), onsets.at(frame).cend(), notesDiff.at(frame).cbegin(), notesDiff[frame].begin(), [&](auto const& lhs, auto const& rhs)
-                           {
-                               return std::max(lhs, rhs * ratio);
-                           });
+            for(size_t note = 0; note < modelNumNotes; ++note)
+            {
+                activeFrames[frame][note] = getValue(frames, startFrame + frame, note) > threshold;
+            }
         }
-        return notesDiff;
     }
 
-    std::vector<Note> getNotes(std::vector<std::array<float, modelNumNotes>> const& currentFrames, std::vector<std::array<float, modelNumNotes>> const& currentOnsets, bool inferOnsets, size_t voiceIndex, float frameEnergyThreshold, float onsetEnergyThreshold, double minNoteDuration, long maxFramesBelowThreshold, std::optional<float> const minFreq, std::optional<float> const maxFreq, bool melodiaTrick)
+    // The threshold is converted to the quantized domain so the contiguous
+    // frames of each note are compared as integers, the blocks are aligned
+    // on the chunks
+    static void getActiveFrames(PosteriorgramView const& frames, float threshold, size_t startFrame, size_t numFrames, std::vector<std::bitset<modelNumNotes>>& activeFrames)
     {
-        std::vector<Note> notes;
-        auto onsets = inferOnsets ? getInferredOnsets(currentOnsets, currentFrames) : currentOnsets;
-        auto frames = currentFrames;
+        assert(startFrame % Posteriorgram::chunkNumFrames == 0 && numFrames <= Posteriorgram::chunkNumFrames);
+        std::fill(activeFrames.begin(), std::next(activeFrames.begin(), static_cast<long>(numFrames)), std::bitset<modelNumNotes>());
+        auto minValue = 0;
+        while(minValue < 256 && !(Posteriorgram::dequantize(static_cast<uint8_t>(minValue)) > threshold))
+        {
+            ++minValue;
+        }
+        if(minValue >= 256)
+        {
+            return;
+        }
+        std::array<uint8_t, Posteriorgram::chunkNumFrames> actives;
+        auto const chunk = startFrame / Posteriorgram::chunkNumFrames;
+        for(size_t note = 0; note < modelNumNotes; ++note)
+        {
+            auto const* frameData = frames.getChunkData(chunk, note);
+            for(size_t frame = 0; frame < numFrames; ++frame)
+            {
+                actives[frame] = frameData[frame] >= minValue ? 1 : 0;
+            }
+            for(size_t frame = 0; frame < numFrames; ++frame)
+            {
+                if(actives[frame] != 0)
+                {
+                    activeFrames[frame].set(note);
+                }
+            }
+        }
+    }
 
-        auto const numFrames = frames.size();
-        auto const minNoteLength = secondsToFrame(minNoteDuration);
+    // The mask of the frames of a window is kept in memory, the mask of the
+    // frames of a posteriorgram shares its memory budget
+    static size_t getMaskMemoryBudget(Activations const&)
+    {
+        return 0;
+    }
+
+    static size_t getMaskMemoryBudget(PosteriorgramView const& frames)
+    {
+        return frames.getMemoryBudget();
+    }
+
+    static std::filesystem::path getMaskDirectory(Activations const&)
+    {
+        return {};
+    }
+
+    static std::filesystem::path getMaskDirectory(PosteriorgramView const& frames)
+    {
+        return frames.getSpillDirectory();
+    }
+
+    template <typename Frames, typename Onsets>
+    static std::vector<FrameNote> extractNotes(Frames const& currentFrames, Onsets const& onsets, Decoder::Settings const& settings)
+    {
+        std::vector<FrameNote> notes;
+        auto const numFrames = currentFrames.size();
+        if(numFrames < 2)
+        {
+            return notes;
+        }
+
+        // The frames are never modified, the energies that are consumed by
+        // the notes are masked instead
+        PosteriorgramMask maskedFrames(numFrames, getMaskMemoryBudget(currentFrames), getMaskDirectory(currentFrames));
+        auto const getEnergy = [&](size_t frame, size_t note)
+        {
+            return maskedFrames.test(frame, note) ? 0.0f : getValue(currentFrames, frame, note);
+        };
+        auto const maskEnergy = [&](size_t frame, size_t note)
+        {
+            maskedFrames.set(frame, note);
+        };
+
+        auto const frameEnergyThreshold = settings.frameEnergyThreshold;
+        auto const onsetEnergyThreshold = settings.onsetEnergyThreshold;
+        auto const maxFramesBelowThreshold = settings.maxFramesBelowThreshold;
+        auto const& minFreq = settings.minFreq;
+        auto const& maxFreq = settings.maxFreq;
+        auto const minNoteLength = secondsToFrame(settings.minNoteDuration);
         auto const lastFrameIndex = numFrames - 1;
         auto const maxNoteIndex = std::clamp(maxFreq.has_value() ? static_cast<size_t>(std::round(hertzToMidi(maxFreq.value())) - modelNoteOffset) : modelNumNotes, size_t(0), size_t(modelNumNotes));
         auto const minNoteIndex = std::clamp(minFreq.has_value() ? static_cast<size_t>(std::round(hertzToMidi(minFreq.value())) - modelNoteOffset) : size_t(0), size_t(0), size_t(modelNumNotes));
 
-        for(long frameStartIndex = static_cast<long>(lastFrameIndex) - 1; frameStartIndex >= 0; --frameStartIndex)
+        // The peaks of the onsets don't depend on the masked energies so they
+        // are found note by note and then processed from the last frame to
+        // the first one and from the highest note to the lowest one. The
+        // blocks of frames are processed from the last one to the first one
+        // so only the peaks of a block are kept in memory. The onsets of a
+        // block are preceded by the last two onsets of the previous block
+        // (the first onset is its own previous onset).
+        static auto constexpr blockSize = Posteriorgram::chunkNumFrames;
+        auto const numBlocks = (numFrames + blockSize - 1) / blockSize;
+        auto const blockStride = std::min(blockSize, numFrames);
+        std::vector<float> blockOnsets(modelNumNotes * blockStride);
+        std::vector<float> previousBlockOnsets(modelNumNotes * blockStride);
+        auto const readBlock = [&](size_t block, std::vector<float>& output)
         {
-            auto const fsi = static_cast<size_t>(frameStartIndex);
-            for(long noteIndex = static_cast<long>(maxNoteIndex) - 1; noteIndex >= static_cast<long>(minNoteIndex); noteIndex--)
+            auto const startFrame = block * blockSize;
+            auto const numBlockFrames = std::min(blockSize, numFrames - startFrame);
+            for(auto ni = minNoteIndex; ni < maxNoteIndex; ++ni)
+            {
+                readNote(onsets, ni, startFrame, numBlockFrames, output.data() + ni * blockStride);
+            }
+        };
+        std::vector<std::pair<size_t, size_t>> onsetPeaks;
+        std::array<float, blockSize + 2> noteOnsets;
+        std::array<uint8_t, blockSize + 1> peaks;
+        readBlock(numBlocks - 1, blockOnsets);
+        for(auto block = numBlocks; block-- > 0;)
+        {
+            auto const startFrame = block * blockSize;
+            auto const numBlockFrames = std::min(blockSize, numFrames - startFrame);
+            if(block > 0)
+            {
+                readBlock(block - 1, previousBlockOnsets);
+            }
+            onsetPeaks.clear();
+            for(auto ni = minNoteIndex; ni < maxNoteIndex; ++ni)
             {
-                auto const ni = static_cast<size_t>(noteIndex);
-                auto const currentOnset = onsets.at(fsi).at(ni);
-                auto const previousOnset = (fsi <= 0) ? currentOnset : onsets.at(fsi - 1).at(ni);
-                auto const nextOnset = (fsi >= lastFrameIndex) ? currentOnset : onsets.at(fsi + 1).at(ni);
+                auto const* data = blockOnsets.data() + ni * blockStride;
+                std::copy(data, data + numBlockFrames, noteOnsets.data() + 2);
+                if(block > 0)
+                {
+                    auto const* previousData = previousBlockOnsets.data() + ni * blockStride;
+                    noteOnsets[0] = previousData[blockStride - 2];
+                    noteOnsets[1] = previousData[blockStride - 1];
+                }
+                else
+                {
+                    noteOnsets[0] = noteOnsets[2];
+                    noteOnsets[1] = noteOnsets[2];
+                }
 
-                if(currentOnset >= onsetEnergyThreshold && currentOnset >= previousOnset && currentOnset >= nextOnset)
+                // The onset at index is the onset of the frame startFrame + index - 2,
+                // the last onset of the block is only used as the next onset
+                auto const firstIndex = startFrame == 0 ? size_t(2) : size_t(1);
+                auto const lastIndex = numBlockFrames + 1;
+                // The onset must be above the previous one so a plateau of
+                // the quantized onsets only gives a peak at its first frame
+                for(auto index = firstIndex; index < lastIndex; ++index)
+                {
+                    auto const onset = noteOnsets[index];
+                    peaks[index] = (onset >= onsetEnergyThreshold) & (onset > noteOnsets[index - 1]) & (onset >= noteOnsets[index + 1]);
+                }
+                for(auto index = firstIndex; index < lastIndex; ++index)
                 {
-                    auto fei = fsi + 1;
-                    auto accumulatedFrames = 0;
-                    while(fei < lastFrameIndex && accumulatedFrames < maxFramesBelowThreshold)
+                    if(peaks[index] != 0)
                     {
-                        auto const energy = frames.at(fei).at(ni);
-                        accumulatedFrames = energy < frameEnergyThreshold ? accumulatedFrames + 1 : 0;
-                        ++fei;
+                        onsetPeaks.push_back({startFrame + index - 2, ni});
                     }
-                    fei -= accumulatedFrames;
-                    auto const frameDuration = fei - fsi;
+                }
+            }
+            std::sort(onsetPeaks.begin(), onsetPeaks.end(), std::greater<>());
+
+            for(auto const& [fsi, ni] : onsetPeaks)
+            {
+                auto fei = fsi + 1;
+                auto accumulatedFrames = 0;
+                while(fei < lastFrameIndex && accumulatedFrames < maxFramesBelowThreshold)
+                {
+                    auto const energy = getEnergy(fei, ni);
+                    accumulatedFrames = energy < frameEnergyThreshold ? accumulatedFrames + 1 : 0;
+                    ++fei;
+                }
+                fei -= accumulatedFrames;
+                auto const frameDuration = fei - fsi;
 
-                    if(frameDuration > minNoteLength)
+                if(frameDuration > minNoteLength)
+                {
+                    auto amplitude = 0.0;
+                    for(auto cf = fsi; cf < fei; cf++)
                     {
-                        auto amplitude = 0.0;
-                        for(auto cf = fsi; cf < fei; cf++)
+                        maskEnergy(cf, ni);
+                        if(ni < modelNumNotes - 1)
                         {
-                            auto& cframe = frames[cf];
-                            cframe[ni] = 0.0f;
-                            if(ni < modelNumNotes - 1)
-                            {
-                                cframe[ni + 1] = 0.0f;
-                            }
-                            if(ni > 0)
-                            {
-                                cframe[ni - 1] = 0.0f;
-                            }
-                            amplitude += static_cast<double>(currentFrames.at(cf).at(ni));
+                            maskEnergy(cf, ni + 1);
+                        }
+                        if(ni > 0)
+                        {
+                            maskEnergy(cf, ni - 1);
                         }
-                        amplitude /= static_cast<double>(frameDuration);
-                        notes.push_back({frameToSeconds(fsi), frameToSeconds(fei), midiToHertz(ni + modelNoteOffset), static_cast<float>(amplitude)});
+                        amplitude += static_cast<double>(getValue(currentFrames, cf, ni));
                     }
+                    amplitude /= static_cast<double>(frameDuration);
+                    notes.push_back({fsi, fei, ni, static_cast<float>(amplitude)});
                 }
             }
+            std::swap(blockOnsets, previousBlockOnsets);
         }
 
-        if(melodiaTrick)
+        if(settings.melodiaTrick)
         {
+            // The thresholds are positive so the masked energies are never
+            // active, the active frames are computed block by block
+            std::vector<std::bitset<modelNumNotes>> activeFrames(blockStride);
+            auto activeBlock = numBlocks;
             for(long frameIndex = static_cast<long>(lastFrameIndex) - 1; frameIndex >= 0; --frameIndex)
             {
                 auto const fi = static_cast<size_t>(frameIndex);
+                if(fi / blockSize != activeBlock)
+                {
+                    activeBlock = fi / blockSize;
+                    getActiveFrames(currentFrames, frameEnergyThreshold, activeBlock * blockSize, std::min(blockSize, numFrames - activeBlock * blockSize), activeFrames);
+                }
+                auto const& activeFrame = activeFrames[fi % blockSize];
+                if(activeFrame.none())
+                {
+                    continue;
+                }
                 for(long noteIndex = static_cast<long>(maxNoteIndex) - 1; noteIndex >= static_cast<long>(minNoteIndex); noteIndex--)
                 {
                     auto const ni = static_cast<size_t>(noteIndex);
-                    auto const energy = frames.at(fi).at(ni);
-                    if(energy > frameEnergyThreshold)
+                    if(activeFrame.test(ni) && !maskedFrames.test(fi, ni))
                     {
-                        frames[fi][ni] = 0.0f;
+                        maskEnergy(fi, ni);
                         auto fei = frameIndex + 1;
                         {
                             auto accumulatedFrames = 0;
                             while(fei < lastFrameIndex && accumulatedFrames < maxFramesBelowThreshold)
                             {
-                                auto& cframe = frames[fei];
-                                accumulatedFrames = cframe.at(ni) < frameEnergyThreshold ? accumulatedFrames + 1 : 0;
-                                cframe[ni] = 0.0f;
+                                auto const cf = static_cast<size_t>(fei);
+                                accumulatedFrames = getEnergy(cf, ni) < frameEnergyThreshold ? accumulatedFrames + 1 : 0;
+                                maskEnergy(cf, ni);
                                 if(noteIndex < modelNumNotes - 1)
                                 {
-                                    cframe[ni + 1] = 0.0f;
+                                    maskEnergy(cf, ni + 1);
                                 }
                                 if(noteIndex > 0)
                                 {
-                                    cframe[ni - 1] = 0.0f;
+                                    maskEnergy(cf, ni - 1);
                                 }
                                 ++fei;
                             }
@@ -162,16 +474,16 @@ namespace Bpvp
                             auto accumulatedFrames = 0;
                             while(fsi > 0 && accumulatedFrames < maxFramesBelowThreshold)
                             {
-                                auto& cframe = frames[fsi];
-                                accumulatedFrames = cframe.at(ni) < frameEnergyThreshold ? accumulatedFrames + 1 : 0;
-                                cframe[ni] = 0.0f;
+                                auto const cf = static_cast<size_t>(fsi);
+                                accumulatedFrames = getEnergy(cf, ni) < frameEnergyThreshold ? accumulatedFrames + 1 : 0;
+                                maskEnergy(cf, ni);
                                 if(noteIndex < modelNumNotes - 1)
                                 {
-                                    cframe[ni + 1] = 0.0f;
+                                    maskEnergy(cf, ni + 1);
                                 }
                                 if(noteIndex > 0)
                                 {
-                                    cframe[ni - 1] = 0.0f;
+                                    maskEnergy(cf, ni - 1);
                                 }
                                 --fsi;
                             }
@@ -188,10 +500,10 @@ namespace Bpvp
                             auto amplitude = 0.0;
                             for(auto cf = fsi; cf < fei; cf++)
                             {
-                                amplitude += static_cast<double>(currentFrames.at(cf).at(ni));
+                                amplitude += static_cast<double>(getValue(currentFrames, static_cast<size_t>(cf), ni));
                             }
                             amplitude /= static_cast<double>(frameDuration);
-                            notes.push_back({frameToSeconds(fsi), frameToSeconds(fei), midiToHertz(ni + modelNoteOffset), static_cast<float>(amplitude)});
+                            notes.push_back({static_cast<size_t>(fsi), static_cast<size_t>(fei), ni, static_cast<float>(amplitude)});
                         }
                     }
                 }
@@ -200,55 +512,169 @@ namespace Bpvp
 
         auto const noteCmp = [](auto const& lhs, auto const& rhs)
         {
-            return lhs.start < rhs.start || (lhs.start <= rhs.start && lhs.pitch < rhs.pitch);
+            return lhs.start < rhs.start || (lhs.start <= rhs.start && lhs.index < rhs.index);
         };
 
-        if(!notes.empty())
+        // The overlapping notes of the same pitch are merged in a single pass
+        // by extending the last kept note of each pitch
+        std::sort(notes.begin(), notes.end(), noteCmp);
+        std::array<size_t, modelNumNotes> lastNotes;
+        lastNotes.fill(notes.size());
+        size_t numNotes = 0;
+        for(size_t index = 0; index < notes.size(); ++index)
         {
-            std::sort(notes.begin(), notes.end(), noteCmp);
-            for(auto it = notes.begin(); it < notes.end(); ++it)
+            auto const note = notes[index];
+            auto& lastNote = lastNotes[note.index];
+            if(lastNote < numNotes && note.start < notes[lastNote].end)
+            {
+                notes[lastNote].end = std::max(notes[lastNote].end, note.end);
+            }
+            else
             {
-                auto next = std::next(it);
-                while(next != notes.end() && next->start < it->end)
+                lastNote = numNotes;
+                notes[numNotes++] = note;
+            }
+        }
+        notes.resize(numNotes);
+        return notes;
+    }
+
+    void VoiceAllocator::reset()
+    {
+        mActiveVoices = {};
+        mFreeVoices = {};
+        mNumVoices = 0;
+    }
+
+    size_t VoiceAllocator::assign(size_t start, size_t end)
+    {
+        while(!mActiveVoices.empty() && mActiveVoices.top().first <= start)
+        {
+            mFreeVoices.push(mActiveVoices.top().second);
+            mActiveVoices.pop();
+        }
+        auto voice = mNumVoices;
+        if(mFreeVoices.empty())
+        {
+            ++mNumVoices;
+        }
+        else
+        {
+            voice = mFreeVoices.top();
+            mFreeVoices.pop();
+        }
+        mActiveVoices.push({end, voice});
+        return voice;
+    }
+
+    std::vector<Note> getNotes(PosteriorgramView const& currentFrames, PosteriorgramView const& currentOnsets, bool inferOnsets, size_t voiceIndex, float frameEnergyThreshold, float onsetEnergyThreshold, double minNoteDuration, long maxFramesBelowThreshold, std::optional<float> const minFreq, std::optional<float> const maxFreq, bool melodiaTrick)
+    {
+        auto const settings = Decoder::Settings{inferOnsets, voiceIndex, frameEnergyThreshold, onsetEnergyThreshold, minNoteDuration, maxFramesBelowThreshold, minFreq, maxFreq, melodiaTrick};
+        auto const frameNotes = inferOnsets ? extractNotes(currentFrames, InferredOnsetsView{currentOnsets, currentFrames, getInferredOnsetsRatio(currentOnsets, currentFrames)}, settings) : extractNotes(currentFrames, currentOnsets, settings);
+        std::vector<Note> notes;
+        notes.reserve(frameNotes.size());
+        VoiceAllocator voiceAllocator;
+        for(auto const& note : frameNotes)
+        {
+            if(voiceIndex == 0 || voiceAllocator.assign(note.start, note.end) + 1 == voiceIndex)
+            {
+                notes.push_back(toNote(note, 0));
+            }
+        }
+        return notes;
+    }
+
+    void Decoder::prepare(Settings const& settings, size_t lookbackFrames)
+    {
+        mSettings = settings;
+        mLookbackFrames = std::max(lookbackFrames, static_cast<size_t>(1));
+        reset();
+    }
+
+    void Decoder::reset()
+    {
+        mFrames.clear();
+        mOnsets.clear();
+        mNotesDiff.clear();
+        mFrameOffset = 0;
+        mFinalisedFrame = 0;
+        mMaxOnset = 0.0f;
+        mMaxDiff = 0.0f;
+        mVoiceAllocator.reset();
+    }
+
+    void Decoder::addFrames(float const* frames, float const* onsets, size_t numFrames)
+    {
+        mFrames.reserve(mFrames.size() + numFrames);
+        mOnsets.reserve(mOnsets.size() + numFrames);
+        mNotesDiff.reserve(mNotesDiff.size() + numFrames);
+        for(size_t frame = 0; frame < numFrames; ++frame)
+        {
+            mFrames.push_back({});
+            std::copy(frames, frames + modelNumNotes, mFrames.back().begin());
+            mOnsets.push_back({});
+            std::copy(onsets, onsets + modelNumNotes, mOnsets.back().begin());
+            mNotesDiff.push_back({});
+            mMaxDiff = std::max(getNotesDiff(mFrames, mFrames.size() - 1, mFrameOffset, mNotesDiff.back()), mMaxDiff);
+            mMaxOnset = std::max(*std::max_element(mOnsets.back().cbegin(), mOnsets.back().cend()), mMaxOnset);
+            frames += modelNumNotes;
+            onsets += modelNumNotes;
+        }
+    }
+
+    std::vector<Note> Decoder::getNotes(bool flush)
+    {
+        if(mFrames.empty())
+        {
+            return {};
+        }
+        auto const numFrames = mFrames.size();
+        auto const finalisedFrame = mFinalisedFrame - mFrameOffset;
+        auto horizonFrame = flush ? numFrames : (numFrames > mLookbackFrames ? numFrames - mLookbackFrames : size_t(0));
+        if(horizonFrame <= finalisedFrame)
+        {
+            return {};
+        }
+
+        auto const frameNotes = mSettings.inferOnsets ? extractNotes(mFrames, ScaledOnsetsView{mOnsets, mNotesDiff, getInferredOnsetsRatio(mMaxOnset, mMaxDiff)}, mSettings) : extractNotes(mFrames, mOnsets, mSettings);
+        if(!flush && numFrames < mLookbackFrames * 4)
+        {
+            // The notes that still reach the end of the window might be
+            // extended by the next frames so the horizon is moved back
+            // (unless the window is already too large)
+            auto const ongoingFrame = numFrames - 1 - std::min(static_cast<size_t>(std::max(mSettings.maxFramesBelowThreshold, 0l)), numFrames - 1);
+            for(auto const& note : frameNotes)
+            {
+                if(note.start >= finalisedFrame && note.start < horizonFrame && note.end >= ongoingFrame)
                 {
-                    if(std::abs(next->pitch - it->pitch) < std::numeric_limits<float>::epsilon())
-                    {
-                        it->end = std::max(it->end, next->end);
-                        next = notes.erase(next);
-                    }
-                    else
-                    {
-                        next = std::next(next);
-                    }
+                    horizonFrame = note.start;
                 }
             }
+        }
 
-            //            for(size_t voice = 0; voice <= voiceIndex; ++voice)
-            //            {
-            //                std::vector<Note> remainings;
-            //                for(auto it = notes.begin(); it < notes.end(); ++it)
-            //                {
-            //                    auto next = std::next(it);
-            //                    while(next != notes.end() && next->start < it->end)
-            //                    {
-            //                        if(next->pitch > it->pitch)
-            //                        {
-            //                            remainings.push_back(*next);
-            //                            next = notes.erase(next);
-            //                        }
-            //                        else
-            //                        {
-            //                            next = std::next(next);
-            //                        }
-            //                    }
-            //                }
-            //                if(voice < voiceIndex)
-            //                {
-            //                    notes = remainings;
-            //                }
-            //            }
+        std::vector<Note> notes;
+        for(auto const& note : frameNotes)
+        {
+            if(note.start >= finalisedFrame && note.start < horizonFrame)
+            {
+                if(mSettings.voiceIndex == 0 || mVoiceAllocator.assign(note.start + mFrameOffset, note.end + mFrameOffset) + 1 == mSettings.voiceIndex)
+                {
+                    notes.push_back(toNote(note, mFrameOffset));
+                }
+            }
         }
+        mFinalisedFrame = std::max(mFinalisedFrame, horizonFrame + mFrameOffset);
 
+        // The frames before the horizon are kept as context for the next
+        // notes but the window never exceeds the lookback
+        if(horizonFrame > mLookbackFrames)
+        {
+            auto const numRemovedFrames = static_cast<long>(horizonFrame - mLookbackFrames);
+            mFrames.erase(mFrames.begin(), std::next(mFrames.begin(), numRemovedFrames));
+            mOnsets.erase(mOnsets.begin(), std::next(mOnsets.begin(), numRemovedFrames));
+            mNotesDiff.erase(mNotesDiff.begin(), std::next(mNotesDiff.begin(), numRemovedFrames));
+            mFrameOffset += static_cast<size_t>(numRemovedFrames);
+        }
         return notes;
     }
 } // namespace Bpvp
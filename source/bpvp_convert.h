@@ -1,10 +1,12 @@
 #pragma once
 
 #include "bpvp_model.h"
+#include "bpvp_posteriorgram.h"
 #include <array>
 #include <cmath>
 #include <functional>
 #include <optional>
+#include <queue>
 #include <vector>
 
 namespace Bpvp
@@ -17,5 +19,66 @@ namespace Bpvp
         float amplitude;
     };
 
-    std::vector<Note> getNotes(std::vector<std::array<float, modelNumNotes>> const& frames, std::vector<std::array<float, modelNumNotes>> const& onsets, bool inferOnsets, size_t voiceIndex, float frameEnergyThreshold, float onsetEnergyThreshold, double minNoteDuration, long maxFramesBelowThreshold, std::optional<float> const minFreq = {}, std::optional<float> const maxFreq = {}, bool melodiaTrick = true);
+    std::vector<Note> getNotes(PosteriorgramView const& frames, PosteriorgramView const& onsets, bool inferOnsets, size_t voiceIndex, float frameEnergyThreshold, float onsetEnergyThreshold, double minNoteDuration, long maxFramesBelowThreshold, std::optional<float> const minFreq = {}, std::optional<float> const maxFreq = {}, bool melodiaTrick = true);
+
+    // The voice allocator assigns the notes, sorted by start, to the lowest
+    // voice that is free at the start of the note so the notes of a voice
+    // never overlap (the voices are indexed from zero)
+    class VoiceAllocator
+    {
+    public:
+        VoiceAllocator() = default;
+        ~VoiceAllocator() = default;
+
+        void reset();
+        size_t assign(size_t start, size_t end);
+
+    private:
+        using ActiveVoice = std::pair<size_t, size_t>;
+        std::priority_queue<ActiveVoice, std::vector<ActiveVoice>, std::greater<>> mActiveVoices;
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<>> mFreeVoices;
+        size_t mNumVoices{0};
+    };
+
+    // The decoder extracts the notes progressively while the frames are
+    // added, only the frames of the lookback window are kept in memory.
+    // A note is finalised once it started before the lookback horizon and
+    // no longer reaches the end of the window.
+    class Decoder
+    {
+    public:
+        struct Settings
+        {
+            bool inferOnsets{true};
+            size_t voiceIndex{0}; // 0 for all the voices, otherwise the voice number (from 1)
+            float frameEnergyThreshold{0.7f};
+            float onsetEnergyThreshold{0.5f};
+            double minNoteDuration{0.12};
+            long maxFramesBelowThreshold{11};
+            std::optional<float> minFreq{};
+            std::optional<float> maxFreq{};
+            bool melodiaTrick{true};
+        };
+
+        Decoder() = default;
+        ~Decoder() = default;
+
+        void prepare(Settings const& settings, size_t lookbackFrames);
+        void reset();
+
+        void addFrames(float const* frames, float const* onsets, size_t numFrames);
+        std::vector<Note> getNotes(bool flush);
+
+    private:
+        Settings mSettings;
+        size_t mLookbackFrames{modelNumFrames * 3};
+        std::vector<std::array<float, modelNumNotes>> mFrames;
+        std::vector<std::array<float, modelNumNotes>> mOnsets;
+        std::vector<std::array<float, modelNumNotes>> mNotesDiff;
+        size_t mFrameOffset{0};
+        size_t mFinalisedFrame{0};
+        float mMaxOnset{0.0f};
+        float mMaxDiff{0.0f};
+        VoiceAllocator mVoiceAllocator;
+    };
 } // namespace Bpvp
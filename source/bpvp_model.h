@@ -6,6 +6,12 @@ namespace Bpvp
 {
     extern const void* model;
     extern const size_t model_size;
+    // The reduced precision variants of the model (with float16 weights and
+    // with dynamic range int8 weights) are null when they are not embedded
+    extern const void* model_fp16;
+    extern const size_t model_fp16_size;
+    extern const void* model_int8;
+    extern const size_t model_int8_size;
 
     static auto constexpr modelSampleRate = 22050;
     static auto constexpr modelFFTHope = 256;
@@ -16,5 +22,10 @@ namespace Bpvp
     static auto constexpr modelNumNotes = 88;
     static auto constexpr modelNoteOffset = 21;
     static auto constexpr modelTensorSize = modelNumFrames * modelNumNotes;
+    static auto constexpr modelContextSize = modelBlockPadding / 2;
+    static auto constexpr modelNumTrimmedFrames = modelContextSize / modelFFTHope;
+    static auto constexpr modelNumValidFrames = modelNumFrames - 2 * modelNumTrimmedFrames;
+    static auto constexpr modelNumContourBins = 264;
+    static auto constexpr modelContourTensorSize = modelNumFrames * modelNumContourBins;
 
 } // namespace Bpvp
@@ -0,0 +1,322 @@
+#include "bpvp_posteriorgram.h"
+#include "bpvp_cache.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+
+namespace Bpvp
+{
+    static auto constexpr chunkSize = Posteriorgram::chunkNumFrames * static_cast<size_t>(modelNumNotes);
+
+    // The temporary file is removed with the posteriorgram
+    struct Posteriorgram::SpillFile
+    {
+        ~SpillFile()
+        {
+            mapping.close();
+            stream.close();
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+
+        std::filesystem::path path;
+        std::ofstream stream;
+        MappedFile mapping;
+    };
+
+    Posteriorgram::Posteriorgram() = default;
+    Posteriorgram::~Posteriorgram() = default;
+    Posteriorgram::Posteriorgram(Posteriorgram&& other) noexcept = default;
+    Posteriorgram& Posteriorgram::operator=(Posteriorgram&& other) noexcept = default;
+
+    void Posteriorgram::setMemoryBudget(size_t memoryBudget, std::filesystem::path const& directory)
+    {
+        mMemoryBudget = memoryBudget;
+        mSpillDirectory = directory;
+    }
+
+    bool Posteriorgram::spillChunks()
+    {
+        if(mSpillFile == nullptr)
+        {
+            static std::atomic<uint64_t> fileIndex{0};
+            auto spillFile = std::make_unique<SpillFile>();
+            spillFile->path = mSpillDirectory / ("bpvp-" + std::to_string(std::random_device()()) + "-" + std::to_string(fileIndex++) + ".tmp");
+            spillFile->stream.open(spillFile->path, std::ios::binary | std::ios::trunc);
+            if(!spillFile->stream.is_open())
+            {
+                mMemoryBudget = 0;
+                return false;
+            }
+            mSpillFile = std::move(spillFile);
+        }
+
+        // The mapping is released while the file grows, the chunks are read
+        // again once the file is mapped
+        if(mSpillFile->mapping.data() != nullptr)
+        {
+            mSpillFile->mapping.close();
+            std::fill(mChunkData.begin(), std::next(mChunkData.begin(), static_cast<long>(mNumSpilledChunks)), nullptr);
+        }
+        if(!mSpillFile->stream.is_open())
+        {
+            mSpillFile->stream.open(mSpillFile->path, std::ios::binary | std::ios::app);
+        }
+        for(auto chunk = mNumSpilledChunks; chunk < mChunks.size(); ++chunk)
+        {
+            mSpillFile->stream.write(reinterpret_cast<char const*>(mChunks[chunk].data()), static_cast<std::streamsize>(chunkSize));
+        }
+        mSpillFile->stream.flush();
+        if(!mSpillFile->stream)
+        {
+            mMemoryBudget = 0;
+            return false;
+        }
+        for(auto chunk = mNumSpilledChunks; chunk < mChunks.size(); ++chunk)
+        {
+            mChunks[chunk] = std::vector<uint8_t>();
+            mChunkData[chunk] = nullptr;
+        }
+        mNumSpilledChunks = mChunks.size();
+        return true;
+    }
+
+    bool Posteriorgram::map()
+    {
+        if(mNumSpilledChunks == 0 || mSpillFile->mapping.data() != nullptr)
+        {
+            return true;
+        }
+        mSpillFile->stream.close();
+        if(mSpillFile->mapping.open(mSpillFile->path) && mSpillFile->mapping.size() >= mNumSpilledChunks * chunkSize)
+        {
+            auto const* data = static_cast<uint8_t const*>(mSpillFile->mapping.data());
+            for(size_t chunk = 0; chunk < mNumSpilledChunks; ++chunk)
+            {
+                mChunkData[chunk] = data + chunk * chunkSize;
+            }
+            return true;
+        }
+
+        // The chunks are not read back in memory since their size is not
+        // bounded, they are silent instead
+        static std::vector<uint8_t> const silence(chunkSize, 0);
+        mSpillFile->mapping.close();
+        std::fill(mChunkData.begin(), std::next(mChunkData.begin(), static_cast<long>(mNumSpilledChunks)), silence.data());
+        return false;
+    }
+
+    void Posteriorgram::clear()
+    {
+        mChunks.clear();
+        mChunkData.clear();
+        mNumFrames = 0;
+        mNumSpilledChunks = 0;
+        mSpillFile.reset();
+    }
+
+    bool Posteriorgram::empty() const noexcept
+    {
+        return mNumFrames == 0;
+    }
+
+    size_t Posteriorgram::size() const noexcept
+    {
+        return mNumFrames;
+    }
+
+    bool Posteriorgram::addFrames(float const* data, size_t numFrames)
+    {
+        auto succeeded = true;
+        while(numFrames > 0)
+        {
+            auto const chunkFrame = mNumFrames % chunkNumFrames;
+            if(chunkFrame == 0)
+            {
+                if(mMemoryBudget > 0 && (mChunks.size() - mNumSpilledChunks + 1) * chunkSize > mMemoryBudget)
+                {
+                    succeeded = spillChunks() && succeeded;
+                }
+                mChunks.emplace_back(chunkSize);
+                mChunkData.push_back(mChunks.back().data());
+            }
+            auto const numChunkFrames = std::min(numFrames, chunkNumFrames - chunkFrame);
+            auto* chunk = mChunks.back().data() + chunkFrame;
+            for(size_t frame = 0; frame < numChunkFrames; ++frame)
+            {
+                for(size_t note = 0; note < static_cast<size_t>(modelNumNotes); ++note)
+                {
+                    chunk[note * chunkNumFrames + frame] = quantize(data[note]);
+                }
+                data += modelNumNotes;
+            }
+            numFrames -= numChunkFrames;
+            mNumFrames += numChunkFrames;
+        }
+        return succeeded;
+    }
+
+    size_t Posteriorgram::getNumChunks() const noexcept
+    {
+        return mChunks.size();
+    }
+
+    uint8_t const* Posteriorgram::getChunkData(size_t chunk, size_t note) const noexcept
+    {
+        assert(chunk < mChunks.size() && note < static_cast<size_t>(modelNumNotes));
+        assert(mChunkData[chunk] != nullptr);
+        return mChunkData[chunk] + note * chunkNumFrames;
+    }
+
+    // The chunks written to the file are not counted
+    size_t Posteriorgram::getMemorySize() const noexcept
+    {
+        return (mChunks.size() - mNumSpilledChunks) * chunkSize;
+    }
+
+    size_t Posteriorgram::getMemoryBudget() const noexcept
+    {
+        return mMemoryBudget;
+    }
+
+    std::filesystem::path const& Posteriorgram::getSpillDirectory() const noexcept
+    {
+        return mSpillDirectory;
+    }
+
+    uint8_t Posteriorgram::quantize(float value) noexcept
+    {
+        return static_cast<uint8_t>(std::lround(std::clamp(value, 0.0f, 1.0f) * 255.0f));
+    }
+
+    PosteriorgramView::PosteriorgramView(Posteriorgram const& posteriorgram) noexcept
+    : mPosteriorgram(posteriorgram)
+    {
+    }
+
+    size_t PosteriorgramView::size() const noexcept
+    {
+        return mPosteriorgram.size();
+    }
+
+    size_t PosteriorgramView::getNumChunks() const noexcept
+    {
+        return mPosteriorgram.getNumChunks();
+    }
+
+    uint8_t const* PosteriorgramView::getChunkData(size_t chunk, size_t note) const noexcept
+    {
+        return mPosteriorgram.getChunkData(chunk, note);
+    }
+
+    size_t PosteriorgramView::getMemoryBudget() const noexcept
+    {
+        return mPosteriorgram.getMemoryBudget();
+    }
+
+    std::filesystem::path const& PosteriorgramView::getSpillDirectory() const noexcept
+    {
+        return mPosteriorgram.getSpillDirectory();
+    }
+
+    static auto constexpr maskChunkSize = Posteriorgram::chunkNumFrames * sizeof(std::bitset<modelNumNotes>);
+
+    PosteriorgramMask::PosteriorgramMask(size_t numFrames, size_t memoryBudget, std::filesystem::path const& directory)
+    : mChunks((numFrames + Posteriorgram::chunkNumFrames - 1) / Posteriorgram::chunkNumFrames)
+    , mDirectory(directory)
+    {
+        // Two chunks are always kept so a note that crosses the end of a
+        // chunk doesn't write the chunks back and forth
+        if(memoryBudget > 0)
+        {
+            mMaxResidentChunks = std::max(memoryBudget / maskChunkSize, static_cast<size_t>(2));
+            mSpilledChunks.resize(mChunks.size(), false);
+            mResidentPositions.resize(mChunks.size());
+        }
+    }
+
+    PosteriorgramMask::~PosteriorgramMask()
+    {
+        if(mStream.is_open())
+        {
+            mStream.close();
+            std::error_code ec;
+            std::filesystem::remove(mPath, ec);
+        }
+    }
+
+    bool PosteriorgramMask::spillChunk(size_t chunk)
+    {
+        if(!mStream.is_open())
+        {
+            static std::atomic<uint64_t> fileIndex{0};
+            mPath = mDirectory / ("bpvp-" + std::to_string(std::random_device()()) + "-mask-" + std::to_string(fileIndex++) + ".tmp");
+            mStream.open(mPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+            if(!mStream.is_open())
+            {
+                return false;
+            }
+        }
+        mStream.seekp(static_cast<std::streamoff>(chunk * maskChunkSize));
+        mStream.write(reinterpret_cast<char const*>(mChunks[chunk].data()), static_cast<std::streamsize>(maskChunkSize));
+        if(!mStream)
+        {
+            mStream.clear();
+            return false;
+        }
+        mChunks[chunk] = Chunk();
+        mSpilledChunks[chunk] = true;
+        return true;
+    }
+
+    void PosteriorgramMask::selectChunk(size_t chunk)
+    {
+        assert(chunk < mChunks.size());
+        if(!mChunks[chunk].empty())
+        {
+            if(mMaxResidentChunks > 0)
+            {
+                mResidentChunks.splice(mResidentChunks.begin(), mResidentChunks, mResidentPositions[chunk]);
+            }
+        }
+        else
+        {
+            // If a chunk cannot be written, the memory budget is disabled
+            // and the next chunks are kept in memory
+            if(mMaxResidentChunks > 0 && mResidentChunks.size() >= mMaxResidentChunks)
+            {
+                if(spillChunk(mResidentChunks.back()))
+                {
+                    mResidentChunks.pop_back();
+                }
+                else
+                {
+                    mMaxResidentChunks = 0;
+                    mResidentChunks.clear();
+                }
+            }
+            mChunks[chunk].resize(Posteriorgram::chunkNumFrames);
+            if(!mSpilledChunks.empty() && mSpilledChunks[chunk])
+            {
+                mStream.seekg(static_cast<std::streamoff>(chunk * maskChunkSize));
+                if(!mStream.read(reinterpret_cast<char*>(mChunks[chunk].data()), static_cast<std::streamsize>(maskChunkSize)))
+                {
+                    mStream.clear();
+                    std::fill(mChunks[chunk].begin(), mChunks[chunk].end(), std::bitset<modelNumNotes>());
+                }
+                mSpilledChunks[chunk] = false;
+            }
+            if(mMaxResidentChunks > 0)
+            {
+                mResidentChunks.push_front(chunk);
+                mResidentPositions[chunk] = mResidentChunks.begin();
+            }
+        }
+        mCurrentChunk = chunk;
+        mCurrentFrames = mChunks[chunk].data();
+    }
+} // namespace Bpvp
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "bpvp_model.h"
+#include <bitset>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <vector>
+
+namespace Bpvp
+{
+    // The posteriorgram stores the activations of the notes quantized on
+    // 8 bits (the thresholds don't need more than 1/256 resolution) in
+    // chunks of fixed size. The chunks are allocated when needed and never
+    // moved so adding frames doesn't copy the previous ones. The chunks are
+    // pitch-major so the frames of a note are contiguous. With a memory
+    // budget, the full chunks are written to a temporary file once their
+    // memory exceeds the budget and the file is memory mapped to read them,
+    // so the resident memory stays bounded whatever the length of the input.
+    class Posteriorgram
+    {
+    public:
+        static auto constexpr chunkNumFrames = static_cast<size_t>(1024);
+
+        Posteriorgram();
+        ~Posteriorgram();
+        Posteriorgram(Posteriorgram&& other) noexcept;
+        Posteriorgram& operator=(Posteriorgram&& other) noexcept;
+
+        // A budget of zero keeps all the chunks in memory
+        void setMemoryBudget(size_t memoryBudget, std::filesystem::path const& directory);
+        // Maps the chunks written to the file, it must be called before
+        // reading the posteriorgram. If the file cannot be mapped, the chunks
+        // written to the file are silent and false is returned.
+        bool map();
+
+        void clear();
+        bool empty() const noexcept;
+        size_t size() const noexcept;
+
+        // Returns false if the chunks cannot be written to the temporary
+        // file, they are then kept in memory
+        bool addFrames(float const* data, size_t numFrames);
+        float get(size_t frame, size_t note) const noexcept;
+
+        size_t getNumChunks() const noexcept;
+        uint8_t const* getChunkData(size_t chunk, size_t note) const noexcept;
+        size_t getMemorySize() const noexcept;
+        size_t getMemoryBudget() const noexcept;
+        std::filesystem::path const& getSpillDirectory() const noexcept;
+
+        static uint8_t quantize(float value) noexcept;
+        static float dequantize(uint8_t value) noexcept;
+
+    private:
+        struct SpillFile;
+
+        bool spillChunks();
+
+        std::vector<std::vector<uint8_t>> mChunks;
+        std::vector<uint8_t const*> mChunkData;
+        size_t mNumFrames{0};
+        size_t mMemoryBudget{0};
+        std::filesystem::path mSpillDirectory;
+        std::unique_ptr<SpillFile> mSpillFile;
+        size_t mNumSpilledChunks{0};
+    };
+
+    // A read-only view of a posteriorgram
+    class PosteriorgramView
+    {
+    public:
+        PosteriorgramView(Posteriorgram const& posteriorgram) noexcept;
+
+        size_t size() const noexcept;
+        float get(size_t frame, size_t note) const noexcept;
+
+        size_t getNumChunks() const noexcept;
+        uint8_t const* getChunkData(size_t chunk, size_t note) const noexcept;
+        size_t getMemoryBudget() const noexcept;
+        std::filesystem::path const& getSpillDirectory() const noexcept;
+
+    private:
+        Posteriorgram const& mPosteriorgram;
+    };
+
+    // The mask marks the notes of the frames used by the decoding. It is
+    // stored in chunks of frames like the posteriorgram and, with a memory
+    // budget, the least recently used chunks are written to a temporary
+    // file and read again when needed, so the resident memory of the
+    // decoding stays bounded whatever the length of the input. If the file
+    // cannot be written, the chunks are kept in memory.
+    class PosteriorgramMask
+    {
+    public:
+        PosteriorgramMask(size_t numFrames, size_t memoryBudget, std::filesystem::path const& directory);
+        ~PosteriorgramMask();
+        PosteriorgramMask(PosteriorgramMask const&) = delete;
+        PosteriorgramMask& operator=(PosteriorgramMask const&) = delete;
+
+        bool test(size_t frame, size_t note);
+        void set(size_t frame, size_t note);
+
+    private:
+        using Chunk = std::vector<std::bitset<modelNumNotes>>;
+
+        std::bitset<modelNumNotes>& getFrame(size_t frame);
+        void selectChunk(size_t chunk);
+        bool spillChunk(size_t chunk);
+
+        std::vector<Chunk> mChunks;
+        std::vector<bool> mSpilledChunks;
+        std::list<size_t> mResidentChunks; // From the most to the least recently used
+        std::vector<std::list<size_t>::iterator> mResidentPositions;
+        size_t mMaxResidentChunks{0};
+        size_t mCurrentChunk{0};
+        std::bitset<modelNumNotes>* mCurrentFrames{nullptr};
+        std::filesystem::path mDirectory;
+        std::filesystem::path mPath;
+        std::fstream mStream;
+    };
+
+    // The accessors are inlined because they are used by the inner loops of
+    // the note extraction
+    inline float Posteriorgram::get(size_t frame, size_t note) const noexcept
+    {
+        return dequantize(mChunkData[frame / chunkNumFrames][note * chunkNumFrames + frame % chunkNumFrames]);
+    }
+
+    inline float Posteriorgram::dequantize(uint8_t value) noexcept
+    {
+        return static_cast<float>(value) * (1.0f / 255.0f);
+    }
+
+    inline float PosteriorgramView::get(size_t frame, size_t note) const noexcept
+    {
+        return mPosteriorgram.get(frame, note);
+    }
+
+    inline std::bitset<modelNumNotes>& PosteriorgramMask::getFrame(size_t frame)
+    {
+        auto const chunk = frame / Posteriorgram::chunkNumFrames;
+        if(chunk != mCurrentChunk || mCurrentFrames == nullptr)
+        {
+            selectChunk(chunk);
+        }
+        return mCurrentFrames[frame % Posteriorgram::chunkNumFrames];
+    }
+
+    inline bool PosteriorgramMask::test(size_t frame, size_t note)
+    {
+        return getFrame(frame).test(note);
+    }
+
+    inline void PosteriorgramMask::set(size_t frame, size_t note)
+    {
+        getFrame(frame).set(note);
+    }
+} // namespace Bpvp
@@ -0,0 +1,158 @@
+#include "bpvp_profiler.h"
+
+namespace Bpvp
+{
+    Profiler::Scope::Scope(Profiler& profiler, Stage stage) noexcept
+    : mProfiler(profiler)
+    , mStage(stage)
+    , mEnabled(profiler.isEnabled())
+    {
+        if(mEnabled)
+        {
+            mStart = std::chrono::steady_clock::now();
+        }
+    }
+
+    Profiler::Scope::~Scope()
+    {
+        if(mEnabled)
+        {
+            mProfiler.add(mStage, std::chrono::steady_clock::now() - mStart);
+        }
+    }
+
+    void Profiler::setEnabled(bool state) noexcept
+    {
+        mEnabled.store(state, std::memory_order_relaxed);
+    }
+
+    bool Profiler::isEnabled() const noexcept
+    {
+        return mEnabled.load(std::memory_order_relaxed);
+    }
+
+    void Profiler::reset() noexcept
+    {
+        for(size_t index = 0; index < numStages; ++index)
+        {
+            mDurations[index].store(0, std::memory_order_relaxed);
+            mMaxDurations[index].store(0, std::memory_order_relaxed);
+            mCounts[index].store(0, std::memory_order_relaxed);
+        }
+        for(auto& counter : mCounters)
+        {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void Profiler::add(Stage stage, std::chrono::steady_clock::duration duration) noexcept
+    {
+        auto const index = static_cast<size_t>(stage);
+        auto const nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        mDurations[index].fetch_add(nanoseconds, std::memory_order_relaxed);
+        mCounts[index].fetch_add(1, std::memory_order_relaxed);
+        auto maxDuration = mMaxDurations[index].load(std::memory_order_relaxed);
+        while(nanoseconds > maxDuration && !mMaxDurations[index].compare_exchange_weak(maxDuration, nanoseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    double Profiler::getDuration(Stage stage) const noexcept
+    {
+        return static_cast<double>(mDurations[static_cast<size_t>(stage)].load(std::memory_order_relaxed)) * 1e-9;
+    }
+
+    double Profiler::getMaxDuration(Stage stage) const noexcept
+    {
+        return static_cast<double>(mMaxDurations[static_cast<size_t>(stage)].load(std::memory_order_relaxed)) * 1e-9;
+    }
+
+    size_t Profiler::getCount(Stage stage) const noexcept
+    {
+        return mCounts[static_cast<size_t>(stage)].load(std::memory_order_relaxed);
+    }
+
+    void Profiler::add(Counter counter, size_t value) noexcept
+    {
+        if(isEnabled())
+        {
+            mCounters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+        }
+    }
+
+    void Profiler::set(Counter counter, size_t value) noexcept
+    {
+        if(isEnabled())
+        {
+            mCounters[static_cast<size_t>(counter)].store(value, std::memory_order_relaxed);
+        }
+    }
+
+    size_t Profiler::get(Counter counter) const noexcept
+    {
+        return mCounters[static_cast<size_t>(counter)].load(std::memory_order_relaxed);
+    }
+
+    void Profiler::write(std::ostream& stream) const
+    {
+        stream << "{";
+        for(size_t index = 0; index < numCounters; ++index)
+        {
+            auto const counter = static_cast<Counter>(index);
+            stream << "\"" << getName(counter) << "\":" << get(counter) << ",";
+        }
+        stream << "\"stages\":{";
+        for(size_t index = 0; index < numStages; ++index)
+        {
+            auto const stage = static_cast<Stage>(index);
+            auto const count = getCount(stage);
+            auto const duration = getDuration(stage);
+            stream << (index > 0 ? "," : "") << "\"" << getName(stage) << "\":{";
+            stream << "\"count\":" << count << ",";
+            stream << "\"total\":" << duration << ",";
+            stream << "\"mean\":" << (count > 0 ? duration / static_cast<double>(count) : 0.0) << ",";
+            stream << "\"max\":" << getMaxDuration(stage) << "}";
+        }
+        stream << "}}";
+    }
+
+    char const* Profiler::getName(Stage stage) noexcept
+    {
+        switch(stage)
+        {
+            case Stage::resampling:
+                return "resampling";
+            case Stage::copy:
+                return "copy";
+            case Stage::scheduling:
+                return "scheduling";
+            case Stage::inference:
+                return "inference";
+            case Stage::decoding:
+                return "decoding";
+        }
+        return "";
+    }
+
+    char const* Profiler::getName(Counter counter) noexcept
+    {
+        switch(counter)
+        {
+            case Counter::blocks:
+                return "blocks";
+            case Counter::windows:
+                return "windows";
+            case Counter::skippedWindows:
+                return "skipped_windows";
+            case Counter::cachedWindows:
+                return "cached_windows";
+            case Counter::accumulatorChunks:
+                return "accumulator_chunks";
+            case Counter::accumulatorMemory:
+                return "accumulator_memory";
+            case Counter::denseFrames:
+                return "dense_frames";
+        }
+        return "";
+    }
+} // namespace Bpvp
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace Bpvp
+{
+    // The profiler accumulates the time spent in the stages of the analysis
+    // and a few counters. The measures are only taken when the profiler is
+    // enabled and the values are atomic since the inference can run in the
+    // worker thread.
+    class Profiler
+    {
+    public:
+        enum class Stage : size_t
+        {
+            resampling,
+            copy,
+            scheduling,
+            inference,
+            decoding
+        };
+
+        enum class Counter : size_t
+        {
+            blocks,
+            windows,
+            skippedWindows,
+            cachedWindows,
+            accumulatorChunks,
+            accumulatorMemory,
+            denseFrames
+        };
+
+        static auto constexpr numStages = static_cast<size_t>(5);
+        static auto constexpr numCounters = static_cast<size_t>(7);
+
+        // Measures the duration of a scope
+        class Scope
+        {
+        public:
+            Scope(Profiler& profiler, Stage stage) noexcept;
+            ~Scope();
+            Scope(Scope const&) = delete;
+            Scope& operator=(Scope const&) = delete;
+
+        private:
+            Profiler& mProfiler;
+            Stage mStage;
+            bool mEnabled;
+            std::chrono::steady_clock::time_point mStart;
+        };
+
+        Profiler() = default;
+        ~Profiler() = default;
+
+        void setEnabled(bool state) noexcept;
+        bool isEnabled() const noexcept;
+        void reset() noexcept;
+
+        void add(Stage stage, std::chrono::steady_clock::duration duration) noexcept;
+        double getDuration(Stage stage) const noexcept;
+        double getMaxDuration(Stage stage) const noexcept;
+        size_t getCount(Stage stage) const noexcept;
+
+        void add(Counter counter, size_t value = 1) noexcept;
+        void set(Counter counter, size_t value) noexcept;
+        size_t get(Counter counter) const noexcept;
+
+        // Writes the measures as a JSON object
+        void write(std::ostream& stream) const;
+
+        static char const* getName(Stage stage) noexcept;
+        static char const* getName(Counter counter) noexcept;
+
+    private:
+        std::atomic<bool> mEnabled{false};
+        std::array<std::atomic<int64_t>, numStages> mDurations{};
+        std::array<std::atomic<int64_t>, numStages> mMaxDurations{};
+        std::array<std::atomic<size_t>, numStages> mCounts{};
+        std::array<std::atomic<size_t>, numCounters> mCounters{};
+    };
+} // namespace Bpvp
@@ -0,0 +1,72 @@
+#include "bpvp_scheduler.h"
+#include <algorithm>
+
+namespace Bpvp
+{
+    Scheduler::Scope::Scope(Scheduler& scheduler, size_t numThreads)
+    : mScheduler(scheduler)
+    , mNumThreads(scheduler.acquire(numThreads))
+    {
+    }
+
+    Scheduler::Scope::~Scope()
+    {
+        mScheduler.release(mNumThreads);
+    }
+
+    Scheduler::Scheduler(size_t budget)
+    : mBudget(std::max(budget, static_cast<size_t>(1)))
+    , mNumAvailableThreads(mBudget)
+    {
+    }
+
+    size_t Scheduler::getBudget() const noexcept
+    {
+        return mBudget;
+    }
+
+    size_t Scheduler::getThreadShare() const
+    {
+        std::scoped_lock lock(mMutex);
+        return std::max(mBudget / std::max(mNumInstances, static_cast<size_t>(1)), static_cast<size_t>(1));
+    }
+
+    void Scheduler::addInstance()
+    {
+        std::scoped_lock lock(mMutex);
+        ++mNumInstances;
+    }
+
+    void Scheduler::removeInstance()
+    {
+        std::scoped_lock lock(mMutex);
+        mNumInstances -= std::min(mNumInstances, static_cast<size_t>(1));
+    }
+
+    size_t Scheduler::acquire(size_t numThreads)
+    {
+        // The tickets keep the inferences in their order of arrival so a
+        // large inference is not delayed indefinitely by smaller ones
+        numThreads = std::clamp(numThreads, static_cast<size_t>(1), mBudget);
+        std::unique_lock lock(mMutex);
+        auto const ticket = mNextTicket++;
+        mCondition.wait(lock, [&]()
+                        {
+                            return ticket == mServedTicket && numThreads <= mNumAvailableThreads;
+                        });
+        mNumAvailableThreads -= numThreads;
+        ++mServedTicket;
+        lock.unlock();
+        mCondition.notify_all();
+        return numThreads;
+    }
+
+    void Scheduler::release(size_t numThreads)
+    {
+        {
+            std::scoped_lock lock(mMutex);
+            mNumAvailableThreads += numThreads;
+        }
+        mCondition.notify_all();
+    }
+} // namespace Bpvp
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace Bpvp
+{
+    // The scheduler shares a budget of threads between the inferences of all
+    // the instances of the process. Each inference reserves the threads of
+    // its interpreter before running and the inferences that don't fit in
+    // the remaining threads wait in their order of arrival, so the instances
+    // don't oversubscribe the cores. The instances also use the budget to
+    // size the thread pools of their interpreters.
+    class Scheduler
+    {
+    public:
+        // Reserves the threads of an inference for the duration of a scope
+        class Scope
+        {
+        public:
+            Scope(Scheduler& scheduler, size_t numThreads);
+            ~Scope();
+            Scope(Scope const&) = delete;
+            Scope& operator=(Scope const&) = delete;
+
+        private:
+            Scheduler& mScheduler;
+            size_t mNumThreads;
+        };
+
+        explicit Scheduler(size_t budget);
+        ~Scheduler() = default;
+
+        size_t getBudget() const noexcept;
+        // The number of threads of an instance when the budget is divided
+        // between the active instances (at least one)
+        size_t getThreadShare() const;
+
+        void addInstance();
+        void removeInstance();
+
+        // The number of threads is limited to the budget
+        size_t acquire(size_t numThreads);
+        void release(size_t numThreads);
+
+    private:
+        mutable std::mutex mMutex;
+        std::condition_variable mCondition;
+        size_t const mBudget;
+        size_t mNumAvailableThreads;
+        size_t mNumInstances{0};
+        uint64_t mNextTicket{0};
+        uint64_t mServedTicket{0};
+    };
+} // namespace Bpvp
@@ -0,0 +1,209 @@
+#include "bpvp_wave.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Bpvp
+{
+    static uint16_t readUint16(unsigned char const* data) noexcept
+    {
+        return static_cast<uint16_t>(data[0] | (data[1] << 8));
+    }
+
+    static uint32_t readUint32(unsigned char const* data) noexcept
+    {
+        return static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+    }
+
+    bool WaveFile::open(std::filesystem::path const& path, std::string& error)
+    {
+        static auto constexpr formatPcm = static_cast<uint16_t>(0x0001);
+        static auto constexpr formatFloat = static_cast<uint16_t>(0x0003);
+        static auto constexpr formatExtensible = static_cast<uint16_t>(0xFFFE);
+
+        close();
+        if(!mFile.open(path))
+        {
+            error = "cannot open the file";
+            return false;
+        }
+        auto const* data = static_cast<unsigned char const*>(mFile.data());
+        auto const size = mFile.size();
+        if(size < 12 || std::memcmp(data, "RIFF", 4) != 0 || std::memcmp(data + 8, "WAVE", 4) != 0)
+        {
+            error = "not a WAVE file";
+            close();
+            return false;
+        }
+
+        // The chunks are parsed until the data chunk, the format chunk must
+        // be defined before
+        uint16_t format = 0;
+        uint16_t bitsPerSample = 0;
+        size_t position = 12;
+        while(position + 8 <= size)
+        {
+            auto const* chunk = data + position;
+            auto const chunkSize = static_cast<size_t>(readUint32(chunk + 4));
+            auto const* chunkData = chunk + 8;
+            auto const availableSize = size - position - 8;
+            if(std::memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16 && chunkSize <= availableSize)
+            {
+                format = readUint16(chunkData);
+                mNumChannels = readUint16(chunkData + 2);
+                mSampleRate = static_cast<double>(readUint32(chunkData + 4));
+                bitsPerSample = readUint16(chunkData + 14);
+                if(format == formatExtensible && chunkSize >= 26)
+                {
+                    format = readUint16(chunkData + 24);
+                }
+            }
+            else if(std::memcmp(chunk, "data", 4) == 0)
+            {
+                if(format == 0)
+                {
+                    error = "the format chunk is missing";
+                    close();
+                    return false;
+                }
+                // The size of the data chunk is truncated to the file for the
+                // streams that are not finalised
+                mData = chunkData;
+                mBytesPerSample = static_cast<size_t>(bitsPerSample / 8);
+                auto const frameSize = mBytesPerSample * mNumChannels;
+                mNumFrames = frameSize > 0 ? std::min(chunkSize, availableSize) / frameSize : 0;
+                break;
+            }
+            position += 8 + chunkSize + (chunkSize & 1);
+        }
+
+        if(mData == nullptr)
+        {
+            error = "the data chunk is missing";
+            close();
+            return false;
+        }
+        if(format == formatPcm && bitsPerSample == 8)
+        {
+            mEncoding = Encoding::int8;
+        }
+        else if(format == formatPcm && bitsPerSample == 16)
+        {
+            mEncoding = Encoding::int16;
+        }
+        else if(format == formatPcm && bitsPerSample == 24)
+        {
+            mEncoding = Encoding::int24;
+        }
+        else if(format == formatPcm && bitsPerSample == 32)
+        {
+            mEncoding = Encoding::int32;
+        }
+        else if(format == formatFloat && bitsPerSample == 32)
+        {
+            mEncoding = Encoding::float32;
+        }
+        else if(format == formatFloat && bitsPerSample == 64)
+        {
+            mEncoding = Encoding::float64;
+        }
+        else
+        {
+            error = "unsupported sample format (" + std::to_string(format) + ", " + std::to_string(bitsPerSample) + " bits)";
+            close();
+            return false;
+        }
+        if(mNumChannels == 0 || mSampleRate <= 0.0)
+        {
+            error = "invalid format";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void WaveFile::close()
+    {
+        mFile.close();
+        mData = nullptr;
+        mBytesPerSample = 0;
+        mNumChannels = 0;
+        mNumFrames = 0;
+        mSampleRate = 0.0;
+    }
+
+    size_t WaveFile::getNumChannels() const noexcept
+    {
+        return mNumChannels;
+    }
+
+    size_t WaveFile::getNumFrames() const noexcept
+    {
+        return mNumFrames;
+    }
+
+    double WaveFile::getSampleRate() const noexcept
+    {
+        return mSampleRate;
+    }
+
+    float WaveFile::getSample(size_t frame, size_t channel) const noexcept
+    {
+        auto const* sample = mData + (frame * mNumChannels + channel) * mBytesPerSample;
+        switch(mEncoding)
+        {
+            case Encoding::int8:
+                return static_cast<float>(static_cast<int>(sample[0]) - 128) / 128.0f;
+            case Encoding::int16:
+                return static_cast<float>(static_cast<int16_t>(readUint16(sample))) / 32768.0f;
+            case Encoding::int24:
+            {
+                auto const value = static_cast<int32_t>(static_cast<uint32_t>(sample[0]) << 8 | static_cast<uint32_t>(sample[1]) << 16 | static_cast<uint32_t>(sample[2]) << 24);
+                return static_cast<float>(value >> 8) / 8388608.0f;
+            }
+            case Encoding::int32:
+                return static_cast<float>(static_cast<double>(static_cast<int32_t>(readUint32(sample))) / 2147483648.0);
+            case Encoding::float32:
+            {
+                float value;
+                std::memcpy(&value, sample, sizeof(float));
+                return value;
+            }
+            case Encoding::float64:
+            {
+                double value;
+                std::memcpy(&value, sample, sizeof(double));
+                return static_cast<float>(value);
+            }
+        }
+        return 0.0f;
+    }
+
+    void WaveFile::read(size_t position, size_t numFrames, float* const* outputs) const
+    {
+        auto const numAvailableFrames = position < mNumFrames ? std::min(numFrames, mNumFrames - position) : static_cast<size_t>(0);
+        for(size_t channel = 0; channel < mNumChannels; ++channel)
+        {
+            for(size_t frame = 0; frame < numAvailableFrames; ++frame)
+            {
+                outputs[channel][frame] = getSample(position + frame, channel);
+            }
+            std::fill(outputs[channel] + numAvailableFrames, outputs[channel] + numFrames, 0.0f);
+        }
+    }
+
+    void WaveFile::readMix(size_t position, size_t numFrames, float* output) const
+    {
+        auto const numAvailableFrames = position < mNumFrames ? std::min(numFrames, mNumFrames - position) : static_cast<size_t>(0);
+        auto const gain = 1.0f / static_cast<float>(std::max(mNumChannels, static_cast<size_t>(1)));
+        for(size_t frame = 0; frame < numAvailableFrames; ++frame)
+        {
+            auto sum = 0.0f;
+            for(size_t channel = 0; channel < mNumChannels; ++channel)
+            {
+                sum += getSample(position + frame, channel);
+            }
+            output[frame] = sum * gain;
+        }
+        std::fill(output + numAvailableFrames, output + numFrames, 0.0f);
+    }
+} // namespace Bpvp
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "bpvp_cache.h"
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace Bpvp
+{
+    // A reader of WAVE files based on a memory mapping, the samples are
+    // converted to floating point when they are read so the file is never
+    // loaded entirely in memory. The 8, 16, 24 and 32 bits integer and the
+    // 32 and 64 bits floating point formats are supported.
+    class WaveFile
+    {
+    public:
+        WaveFile() = default;
+        ~WaveFile() = default;
+
+        bool open(std::filesystem::path const& path, std::string& error);
+        void close();
+
+        size_t getNumChannels() const noexcept;
+        size_t getNumFrames() const noexcept;
+        double getSampleRate() const noexcept;
+
+        // Reads the frames of each channel in separate buffers
+        void read(size_t position, size_t numFrames, float* const* outputs) const;
+        // Reads the average of the channels
+        void readMix(size_t position, size_t numFrames, float* output) const;
+
+    private:
+        enum class Encoding
+        {
+            int8,
+            int16,
+            int24,
+            int32,
+            float32,
+            float64
+        };
+
+        float getSample(size_t frame, size_t channel) const noexcept;
+
+        MappedFile mFile;
+        unsigned char const* mData{nullptr};
+        Encoding mEncoding{Encoding::int16};
+        size_t mBytesPerSample{0};
+        size_t mNumChannels{0};
+        size_t mNumFrames{0};
+        double mSampleRate{0.0};
+    };
+} // namespace Bpvp
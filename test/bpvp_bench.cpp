@@ -0,0 +1,318 @@
+#include "bpvp.h"
+#include "bpvp_signals.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// The benchmark analyses deterministic synthetic signals with the plugin
+// and prints one JSON object per case (JSON Lines) with the real-time
+// factor, the time spent in the stages of the analysis and the peak
+// resident memory. On POSIX systems, each case runs in a child process so
+// the peak memory and the static state of the plugin are not shared.
+//
+// The cases can be repeated with several batch sizes to compare the
+// throughput of the batched inference with the single window inference.
+//
+// Usage: bpvp_bench [--quick] [--signal chords|sweep|noise|silence]
+//                   [--samplerate value] [--blocksize value]
+//                   [--duration seconds] [--batchsizes value,value...]
+//                   [--parameter identifier=value]...
+
+namespace
+{
+    using Bpvp::Test::Generator;
+    using Bpvp::Test::getName;
+    using Bpvp::Test::getSignal;
+    using Bpvp::Test::Signal;
+
+    struct Case
+    {
+        Signal signal;
+        float sampleRate;
+        size_t blockSize;
+        double duration;
+        size_t batchSize{0}; // The value of the parameter if 0
+    };
+
+    using Parameters = std::vector<std::pair<std::string, float>>;
+
+    size_t getPeakMemory()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0)
+        {
+            return 0;
+        }
+        return static_cast<size_t>(counters.PeakWorkingSetSize / 1024);
+#else
+        struct rusage usage;
+        if(getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+#if defined(__APPLE__)
+        return static_cast<size_t>(usage.ru_maxrss / 1024);
+#else
+        return static_cast<size_t>(usage.ru_maxrss);
+#endif
+#endif
+    }
+
+    bool runCase(Case const& benchCase, Parameters const& parameters)
+    {
+        using clock = std::chrono::steady_clock;
+        auto const getSeconds = [](clock::duration duration)
+        {
+            return std::chrono::duration<double>(duration).count();
+        };
+
+        Bpvp::Plugin plugin(benchCase.sampleRate);
+        for(auto const& parameter : parameters)
+        {
+            plugin.setParameter(parameter.first, parameter.second);
+        }
+        if(benchCase.batchSize > 0)
+        {
+            plugin.setParameter("batchsize", static_cast<float>(benchCase.batchSize));
+        }
+        auto& profiler = plugin.getProfiler();
+        profiler.setEnabled(true);
+
+        auto const initialiseStart = clock::now();
+        if(!plugin.initialise(1, benchCase.blockSize, benchCase.blockSize))
+        {
+            std::cerr << "bpvp_bench: the plugin cannot be initialised\n";
+            return false;
+        }
+        auto const initialiseDuration = clock::now() - initialiseStart;
+
+        Generator generator(benchCase.signal, static_cast<double>(benchCase.sampleRate));
+        std::vector<float> buffer(benchCase.blockSize);
+        float const* channels[] = {buffer.data()};
+        auto const numSamples = static_cast<size_t>(std::ceil(benchCase.duration * static_cast<double>(benchCase.sampleRate)));
+        auto processDuration = clock::duration::zero();
+        for(size_t position = 0; position < numSamples; position += benchCase.blockSize)
+        {
+            generator.process(buffer.data(), buffer.size());
+            auto const timestamp = Vamp::RealTime::frame2RealTime(static_cast<long>(position), static_cast<unsigned int>(benchCase.sampleRate));
+            auto const processStart = clock::now();
+            plugin.process(channels, timestamp);
+            processDuration += clock::now() - processStart;
+        }
+        auto const remainingStart = clock::now();
+        auto const features = plugin.getRemainingFeatures();
+        auto const remainingDuration = clock::now() - remainingStart;
+
+        // Each note is described by a feature at its start and a feature at its end
+        auto const numNotes = features.count(0) > 0 ? features.at(0).size() / 2 : static_cast<size_t>(0);
+        auto const analysisDuration = getSeconds(processDuration + remainingDuration);
+        using Stage = Bpvp::Profiler::Stage;
+        std::printf("{\"signal\":\"%s\",\"sample_rate\":%.0f,\"block_size\":%zu,\"batch_size\":%.0f,\"duration\":%.3f,"
+                    "\"initialise\":%.6f,\"process\":%.6f,\"remaining\":%.6f,\"real_time_factor\":%.6f,"
+                    "\"resampling\":%.6f,\"copy\":%.6f,\"inference\":%.6f,\"num_inferences\":%zu,\"decoding\":%.6f,"
+                    "\"num_notes\":%zu,\"peak_memory_kb\":%zu}\n",
+                    getName(benchCase.signal), static_cast<double>(benchCase.sampleRate), benchCase.blockSize, static_cast<double>(plugin.getParameter("batchsize")), benchCase.duration,
+                    getSeconds(initialiseDuration), getSeconds(processDuration), getSeconds(remainingDuration), analysisDuration / benchCase.duration,
+                    profiler.getDuration(Stage::resampling), profiler.getDuration(Stage::copy), profiler.getDuration(Stage::inference), profiler.getCount(Stage::inference), profiler.getDuration(Stage::decoding),
+                    numNotes, getPeakMemory());
+        std::fflush(stdout);
+        return true;
+    }
+
+    bool runIsolatedCase(Case const& benchCase, Parameters const& parameters)
+    {
+#if defined(_WIN32)
+        return runCase(benchCase, parameters);
+#else
+        std::fflush(stdout);
+        auto const pid = fork();
+        if(pid < 0)
+        {
+            return runCase(benchCase, parameters);
+        }
+        if(pid == 0)
+        {
+            _exit(runCase(benchCase, parameters) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+        int status = 0;
+        if(waitpid(pid, &status, 0) != pid)
+        {
+            return false;
+        }
+        return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+#endif
+    }
+
+    std::vector<Case> getDefaultCases(bool quick)
+    {
+        static auto constexpr shortDuration = 30.0;
+        static auto constexpr longDuration = 2.0 * 3600.0;
+        std::vector<Case> cases;
+        for(auto const signal : {Signal::chords, Signal::sweep, Signal::noise, Signal::silence})
+        {
+            for(auto const sampleRate : {22050.0f, 44100.0f, 48000.0f, 96000.0f})
+            {
+                cases.push_back({signal, sampleRate, static_cast<size_t>(1024), shortDuration});
+            }
+            for(auto const blockSize : {static_cast<size_t>(64), static_cast<size_t>(16384)})
+            {
+                cases.push_back({signal, 44100.0f, blockSize, shortDuration});
+            }
+        }
+        if(!quick)
+        {
+            cases.push_back({Signal::chords, 44100.0f, static_cast<size_t>(4096), longDuration});
+            cases.push_back({Signal::silence, 48000.0f, static_cast<size_t>(4096), longDuration});
+        }
+        return cases;
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    auto quick = false;
+    std::optional<Signal> signal;
+    std::optional<float> sampleRate;
+    std::optional<size_t> blockSize;
+    std::optional<double> duration;
+    std::vector<size_t> batchSizes;
+    Parameters parameters;
+    for(auto index = 1; index < argc; ++index)
+    {
+        std::string const argument = argv[index];
+        auto const hasValue = index + 1 < argc;
+        if(argument == "--quick")
+        {
+            quick = true;
+        }
+        else if(argument == "--signal" && hasValue)
+        {
+            signal = getSignal(argv[++index]);
+            if(!signal.has_value())
+            {
+                std::cerr << "bpvp_bench: invalid signal " << argv[index] << "\n";
+                return EXIT_FAILURE;
+            }
+        }
+        else if(argument == "--samplerate" && hasValue)
+        {
+            auto const value = Bpvp::Test::parseNumber(argv[++index]);
+            if(!value.has_value() || value.value() <= 0.0)
+            {
+                std::cerr << "bpvp_bench: invalid sample rate " << argv[index] << "\n";
+                return EXIT_FAILURE;
+            }
+            sampleRate = static_cast<float>(value.value());
+        }
+        else if(argument == "--blocksize" && hasValue)
+        {
+            auto const value = Bpvp::Test::parseNumber(argv[++index]);
+            if(!value.has_value() || value.value() < 1.0 || std::floor(value.value()) != value.value())
+            {
+                std::cerr << "bpvp_bench: invalid block size " << argv[index] << "\n";
+                return EXIT_FAILURE;
+            }
+            blockSize = static_cast<size_t>(value.value());
+        }
+        else if(argument == "--duration" && hasValue)
+        {
+            auto const value = Bpvp::Test::parseNumber(argv[++index]);
+            if(!value.has_value() || value.value() <= 0.0)
+            {
+                std::cerr << "bpvp_bench: invalid duration " << argv[index] << "\n";
+                return EXIT_FAILURE;
+            }
+            duration = value.value();
+        }
+        else if(argument == "--batchsizes" && hasValue)
+        {
+            std::string const list = argv[++index];
+            for(size_t start = 0; start <= list.size();)
+            {
+                auto const end = std::min(list.find(',', start), list.size());
+                auto const value = Bpvp::Test::parseNumber(list.substr(start, end - start));
+                if(!value.has_value() || value.value() < 1.0 || std::floor(value.value()) != value.value())
+                {
+                    std::cerr << "bpvp_bench: invalid batch sizes " << list << "\n";
+                    return EXIT_FAILURE;
+                }
+                batchSizes.push_back(static_cast<size_t>(value.value()));
+                start = end + 1;
+            }
+        }
+        else if(argument == "--parameter" && hasValue)
+        {
+            std::string const parameter = argv[++index];
+            auto const separator = parameter.find('=');
+            auto const value = separator == std::string::npos ? std::optional<double>() : Bpvp::Test::parseNumber(parameter.substr(separator + 1));
+            if(!value.has_value())
+            {
+                std::cerr << "bpvp_bench: invalid parameter " << parameter << "\n";
+                return EXIT_FAILURE;
+            }
+            parameters.emplace_back(parameter.substr(0, separator), static_cast<float>(value.value()));
+        }
+        else
+        {
+            std::cerr << "Usage: bpvp_bench [--quick] [--signal chords|sweep|noise|silence] [--samplerate value] [--blocksize value] [--duration seconds] [--batchsizes value,value...] [--parameter identifier=value]...\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Case> cases;
+    if(signal.has_value() || sampleRate.has_value() || blockSize.has_value() || duration.has_value())
+    {
+        cases.push_back({signal.value_or(Signal::chords), sampleRate.value_or(44100.0f), blockSize.value_or(static_cast<size_t>(1024)), duration.value_or(30.0)});
+    }
+    else
+    {
+        cases = getDefaultCases(quick);
+    }
+    if(!batchSizes.empty())
+    {
+        std::vector<Case> batchCases;
+        for(auto const& benchCase : cases)
+        {
+            for(auto const batchSize : batchSizes)
+            {
+                batchCases.push_back(benchCase);
+                batchCases.back().batchSize = batchSize;
+            }
+        }
+        cases = std::move(batchCases);
+    }
+
+    auto result = EXIT_SUCCESS;
+    for(auto const& benchCase : cases)
+    {
+        if(!runIsolatedCase(benchCase, parameters))
+        {
+            std::cerr << "bpvp_bench: the case " << getName(benchCase.signal) << " " << benchCase.sampleRate << "Hz " << benchCase.blockSize << " failed\n";
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
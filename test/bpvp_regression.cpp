@@ -0,0 +1,372 @@
+#include "bpvp.h"
+#include "bpvp_signals.h"
+#include "bpvp_wave.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// The regression test analyses a fixed set of signals with the float32
+// model and with the reduced precision variants embedded in the build. It
+// compares the notes of each variant to the notes of the float32 model and
+// prints one JSON object per signal and per variant (JSON Lines) with the
+// note-level precision, recall and F-measure and the speed-up of the
+// analysis, followed by a summary of each variant on all the signals. The
+// synthetic signals can be completed with local WAVE files.
+//
+// Usage: bpvp_regression [--duration seconds] [--file path.wav]...
+//                        [--min-fmeasure value] [--parameter identifier=value]...
+
+namespace
+{
+    using Parameters = std::vector<std::pair<std::string, float>>;
+
+    // A note matches a reference note with the same pitch if their onsets
+    // are separated by less than 50ms (the offsets are ignored)
+    static auto constexpr onsetTolerance = 0.05;
+    static auto constexpr blockSize = static_cast<size_t>(4096);
+
+    struct Input
+    {
+        std::string name;
+        float sampleRate;
+        std::vector<float> samples;
+    };
+
+    struct Note
+    {
+        double onset;
+        int pitch;
+    };
+
+    struct Analysis
+    {
+        std::vector<Note> notes;
+        double duration;
+    };
+
+    struct Score
+    {
+        size_t numReferenceNotes{0};
+        size_t numNotes{0};
+        size_t numMatchedNotes{0};
+        double referenceDuration{0.0};
+        double duration{0.0};
+
+        Score& operator+=(Score const& other)
+        {
+            numReferenceNotes += other.numReferenceNotes;
+            numNotes += other.numNotes;
+            numMatchedNotes += other.numMatchedNotes;
+            referenceDuration += other.referenceDuration;
+            duration += other.duration;
+            return *this;
+        }
+
+        double getPrecision() const
+        {
+            return numNotes > 0 ? static_cast<double>(numMatchedNotes) / static_cast<double>(numNotes) : 1.0;
+        }
+
+        double getRecall() const
+        {
+            return numReferenceNotes > 0 ? static_cast<double>(numMatchedNotes) / static_cast<double>(numReferenceNotes) : 1.0;
+        }
+
+        double getFMeasure() const
+        {
+            auto const precision = getPrecision();
+            auto const recall = getRecall();
+            return precision + recall > 0.0 ? 2.0 * precision * recall / (precision + recall) : 0.0;
+        }
+
+        double getSpeedUp() const
+        {
+            return duration > 0.0 ? referenceDuration / duration : 0.0;
+        }
+    };
+
+    struct Variant
+    {
+        char const* name;
+        float parameter;
+        size_t modelSize;
+    };
+
+    std::vector<Input> getSignals(double duration)
+    {
+        static auto constexpr sampleRate = 44100.0f;
+        std::vector<Input> inputs;
+        for(auto const signal : {Bpvp::Test::Signal::chords, Bpvp::Test::Signal::sweep, Bpvp::Test::Signal::noise, Bpvp::Test::Signal::silence})
+        {
+            Input input{Bpvp::Test::getName(signal), sampleRate, std::vector<float>(static_cast<size_t>(std::ceil(duration * static_cast<double>(sampleRate))))};
+            Bpvp::Test::Generator generator(signal, static_cast<double>(sampleRate));
+            generator.process(input.samples.data(), input.samples.size());
+            inputs.push_back(std::move(input));
+        }
+        return inputs;
+    }
+
+    bool readFile(std::string const& path, Input& input)
+    {
+        Bpvp::WaveFile file;
+        std::string error;
+        if(!file.open(path, error))
+        {
+            std::cerr << "bpvp_regression: " << path << ": " << error << "\n";
+            return false;
+        }
+        input.name = path;
+        input.sampleRate = static_cast<float>(file.getSampleRate());
+        input.samples.resize(file.getNumFrames());
+        file.readMix(0, input.samples.size(), input.samples.data());
+        return true;
+    }
+
+    bool analyse(Input const& input, float precision, Parameters const& parameters, Analysis& analysis)
+    {
+        using clock = std::chrono::steady_clock;
+        Bpvp::Plugin plugin(input.sampleRate);
+        for(auto const& parameter : parameters)
+        {
+            plugin.setParameter(parameter.first, parameter.second);
+        }
+        plugin.setParameter("modelprecision", precision);
+        if(!plugin.initialise(1, blockSize, blockSize))
+        {
+            std::cerr << "bpvp_regression: the plugin cannot be initialised\n";
+            return false;
+        }
+
+        // The initialisation is not measured since it includes the warm-up
+        // inference and the tuning of the backend
+        std::vector<float> buffer(blockSize);
+        float const* channels[] = {buffer.data()};
+        auto const start = clock::now();
+        for(size_t position = 0; position < input.samples.size(); position += blockSize)
+        {
+            auto const numSamples = std::min(blockSize, input.samples.size() - position);
+            std::copy(input.samples.cbegin() + static_cast<long>(position), input.samples.cbegin() + static_cast<long>(position + numSamples), buffer.begin());
+            std::fill(buffer.begin() + static_cast<long>(numSamples), buffer.end(), 0.0f);
+            plugin.process(channels, Vamp::RealTime::frame2RealTime(static_cast<long>(position), static_cast<unsigned int>(input.sampleRate)));
+        }
+        auto features = plugin.getRemainingFeatures();
+        analysis.duration = std::chrono::duration<double>(clock::now() - start).count();
+
+        // The features without values mark the end of the notes
+        analysis.notes.clear();
+        for(auto const& feature : features[0])
+        {
+            if(feature.values.size() < 2)
+            {
+                continue;
+            }
+            auto const onset = static_cast<double>(feature.timestamp.sec) + static_cast<double>(feature.timestamp.nsec) * 1e-9;
+            auto const pitch = static_cast<int>(std::round(69.0 + 12.0 * std::log2(static_cast<double>(feature.values[0]) / 440.0)));
+            analysis.notes.push_back({onset, pitch});
+        }
+        return true;
+    }
+
+    // Each reference note is matched with the closest unmatched note of the
+    // same pitch within the tolerance
+    Score compare(Analysis const& reference, Analysis const& analysis)
+    {
+        Score score;
+        score.numReferenceNotes = reference.notes.size();
+        score.numNotes = analysis.notes.size();
+        score.referenceDuration = reference.duration;
+        score.duration = analysis.duration;
+        std::vector<bool> matched(analysis.notes.size(), false);
+        for(auto const& referenceNote : reference.notes)
+        {
+            auto bestIndex = analysis.notes.size();
+            auto bestDistance = onsetTolerance;
+            for(size_t index = 0; index < analysis.notes.size(); ++index)
+            {
+                auto const& note = analysis.notes[index];
+                auto const distance = std::abs(note.onset - referenceNote.onset);
+                if(!matched[index] && note.pitch == referenceNote.pitch && distance <= bestDistance)
+                {
+                    bestIndex = index;
+                    bestDistance = distance;
+                }
+            }
+            if(bestIndex < analysis.notes.size())
+            {
+                matched[bestIndex] = true;
+                ++score.numMatchedNotes;
+            }
+        }
+        return score;
+    }
+
+    // Escapes the quotes, the backslashes and the control characters of a
+    // string for JSON
+    std::string escape(std::string const& text)
+    {
+        std::string result;
+        for(auto const character : text)
+        {
+            if(character == '"' || character == '\\')
+            {
+                result += '\\';
+                result += character;
+            }
+            else if(static_cast<unsigned char>(character) < 0x20)
+            {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned int>(static_cast<unsigned char>(character)));
+                result += code;
+            }
+            else
+            {
+                result += character;
+            }
+        }
+        return result;
+    }
+
+    // The environment variables that override the model or reuse previous
+    // analyses would bias the comparison
+    void clearEnvironment()
+    {
+        for(auto const* name : {"BPVP_MODEL_PRECISION", "BPVP_MODEL_PATH", "BPVP_CACHE_DIR"})
+        {
+#if defined(_WIN32)
+            _putenv_s(name, "");
+#else
+            unsetenv(name);
+#endif
+        }
+    }
+
+    void print(std::string const& input, char const* variant, Score const& score)
+    {
+        std::printf("{\"input\":\"%s\",\"model\":\"%s\",\"reference_notes\":%zu,\"notes\":%zu,\"matched_notes\":%zu,"
+                    "\"precision\":%.6f,\"recall\":%.6f,\"f_measure\":%.6f,\"reference_time\":%.6f,\"time\":%.6f,\"speed_up\":%.6f}\n",
+                    escape(input).c_str(), variant, score.numReferenceNotes, score.numNotes, score.numMatchedNotes,
+                    score.getPrecision(), score.getRecall(), score.getFMeasure(), score.referenceDuration, score.duration, score.getSpeedUp());
+        std::fflush(stdout);
+    }
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    clearEnvironment();
+    auto duration = 30.0;
+    auto minFMeasure = 0.0;
+    std::vector<std::string> files;
+    Parameters parameters;
+    for(auto index = 1; index < argc; ++index)
+    {
+        std::string const argument = argv[index];
+        auto const hasValue = index + 1 < argc;
+        if(argument == "--duration" && hasValue)
+        {
+            auto const value = Bpvp::Test::parseNumber(argv[++index]);
+            if(!value.has_value() || value.value() <= 0.0)
+            {
+                std::cerr << "bpvp_regression: invalid duration " << argv[index] << "\n";
+                return EXIT_FAILURE;
+            }
+            duration = value.value();
+        }
+        else if(argument == "--file" && hasValue)
+        {
+            files.push_back(argv[++index]);
+        }
+        else if(argument == "--min-fmeasure" && hasValue)
+        {
+            auto const value = Bpvp::Test::parseNumber(argv[++index]);
+            if(!value.has_value())
+            {
+                std::cerr << "bpvp_regression: invalid F-measure " << argv[index] << "\n";
+                return EXIT_FAILURE;
+            }
+            minFMeasure = value.value();
+        }
+        else if(argument == "--parameter" && hasValue)
+        {
+            std::string const parameter = argv[++index];
+            auto const separator = parameter.find('=');
+            auto const value = separator == std::string::npos ? std::optional<double>() : Bpvp::Test::parseNumber(parameter.substr(separator + 1));
+            if(!value.has_value())
+            {
+                std::cerr << "bpvp_regression: invalid parameter " << parameter << "\n";
+                return EXIT_FAILURE;
+            }
+            parameters.emplace_back(parameter.substr(0, separator), static_cast<float>(value.value()));
+        }
+        else
+        {
+            std::cerr << "Usage: bpvp_regression [--duration seconds] [--file path.wav]... [--min-fmeasure value] [--parameter identifier=value]...\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto inputs = getSignals(duration);
+    for(auto const& file : files)
+    {
+        Input input;
+        if(!readFile(file, input))
+        {
+            return EXIT_FAILURE;
+        }
+        inputs.push_back(std::move(input));
+    }
+
+    std::vector<Variant> variants;
+    for(auto const& variant : {Variant{"float16", 1.0f, Bpvp::model_fp16_size}, Variant{"int8", 2.0f, Bpvp::model_int8_size}})
+    {
+        if(variant.modelSize == 0)
+        {
+            std::cerr << "bpvp_regression: the " << variant.name << " model is not embedded\n";
+            continue;
+        }
+        variants.push_back(variant);
+    }
+    if(variants.empty())
+    {
+        std::cerr << "bpvp_regression: no reduced precision model to compare\n";
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Score> totals(variants.size());
+    for(auto const& input : inputs)
+    {
+        Analysis reference;
+        if(!analyse(input, 0.0f, parameters, reference))
+        {
+            return EXIT_FAILURE;
+        }
+        for(size_t index = 0; index < variants.size(); ++index)
+        {
+            Analysis analysis;
+            if(!analyse(input, variants[index].parameter, parameters, analysis))
+            {
+                return EXIT_FAILURE;
+            }
+            auto const score = compare(reference, analysis);
+            print(input.name, variants[index].name, score);
+            totals[index] += score;
+        }
+    }
+
+    auto result = EXIT_SUCCESS;
+    for(size_t index = 0; index < variants.size(); ++index)
+    {
+        print("all", variants[index].name, totals[index]);
+        if(totals[index].getFMeasure() < minFMeasure)
+        {
+            std::cerr << "bpvp_regression: the F-measure of the " << variants[index].name << " model is below " << minFMeasure << "\n";
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
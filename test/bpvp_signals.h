@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numbers>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+// The deterministic synthetic signals and the argument parsing shared by
+// the benchmark and the regression tests
+
+namespace Bpvp
+{
+    namespace Test
+    {
+        enum class Signal
+        {
+            chords,
+            sweep,
+            noise,
+            silence
+        };
+
+        inline char const* getName(Signal signal)
+        {
+            switch(signal)
+            {
+                case Signal::chords:
+                    return "chords";
+                case Signal::sweep:
+                    return "sweep";
+                case Signal::noise:
+                    return "noise";
+                case Signal::silence:
+                    return "silence";
+            }
+            return "";
+        }
+
+        inline std::optional<Signal> getSignal(std::string const& name)
+        {
+            for(auto const signal : {Signal::chords, Signal::sweep, Signal::noise, Signal::silence})
+            {
+                if(name == getName(signal))
+                {
+                    return signal;
+                }
+            }
+            return {};
+        }
+
+        // Parses a finite number that fills the whole argument
+        inline std::optional<double> parseNumber(std::string const& text)
+        {
+            try
+            {
+                size_t position = 0;
+                auto const value = std::stod(text, &position);
+                if(position != text.size() || !std::isfinite(value))
+                {
+                    return {};
+                }
+                return value;
+            }
+            catch(std::exception const&)
+            {
+                return {};
+            }
+        }
+
+        // Generates the test signals block by block, the signals only depend on
+        // the sample rate and the position so all the runs are identical
+        class Generator
+        {
+        public:
+            Generator(Signal signal, double sampleRate)
+            : mSignal(signal)
+            , mSampleRate(sampleRate)
+            {
+            }
+
+            void process(float* buffer, size_t numSamples)
+            {
+                for(size_t index = 0; index < numSamples; ++index)
+                {
+                    buffer[index] = getNextSample();
+                }
+            }
+
+        private:
+            float getNextSample()
+            {
+                auto const time = static_cast<double>(mPosition++) / mSampleRate;
+                switch(mSignal)
+                {
+                    case Signal::chords:
+                    {
+                        // A triad every two seconds with a short attack
+                        static std::array<int, 6> const roots{48, 53, 55, 50, 57, 45};
+                        static std::array<int, 3> const intervals{0, 4, 7};
+                        static auto constexpr chordDuration = 2.0;
+                        auto const chord = static_cast<size_t>(time / chordDuration);
+                        auto const chordTime = time - static_cast<double>(chord) * chordDuration;
+                        auto const envelope = std::min(chordTime / 0.01, 1.0) * std::exp(-chordTime);
+                        auto value = 0.0;
+                        for(size_t index = 0; index < intervals.size(); ++index)
+                        {
+                            auto const frequency = 440.0 * std::exp2(static_cast<double>(roots[chord % roots.size()] + intervals[index] - 69) / 12.0);
+                            mPhases[index] = std::fmod(mPhases[index] + frequency / mSampleRate, 1.0);
+                            value += std::sin(2.0 * std::numbers::pi * mPhases[index]);
+                        }
+                        return static_cast<float>(0.15 * envelope * value);
+                    }
+                    case Signal::sweep:
+                    {
+                        // An exponential sweep from 55Hz to 3520Hz every 20 seconds
+                        static auto constexpr sweepDuration = 20.0;
+                        static auto constexpr startFrequency = 55.0;
+                        static auto constexpr endFrequency = 3520.0;
+                        auto const sweepTime = std::fmod(time, sweepDuration);
+                        auto const frequency = startFrequency * std::pow(endFrequency / startFrequency, sweepTime / sweepDuration);
+                        mPhases[0] = std::fmod(mPhases[0] + frequency / mSampleRate, 1.0);
+                        return static_cast<float>(0.3 * std::sin(2.0 * std::numbers::pi * mPhases[0]));
+                    }
+                    case Signal::noise:
+                    {
+                        // A white noise from a xorshift generator
+                        mNoiseState ^= mNoiseState << 13;
+                        mNoiseState ^= mNoiseState >> 7;
+                        mNoiseState ^= mNoiseState << 17;
+                        auto const value = static_cast<double>(mNoiseState >> 11) / static_cast<double>(1ull << 53);
+                        return static_cast<float>(0.2 * (value * 2.0 - 1.0));
+                    }
+                    case Signal::silence:
+                    {
+                        return 0.0f;
+                    }
+                }
+                return 0.0f;
+            }
+
+            Signal mSignal;
+            double mSampleRate;
+            size_t mPosition{0};
+            std::array<double, 3> mPhases{};
+            uint64_t mNoiseState{0x9E3779B97F4A7C15ull};
+        };
+    } // namespace Test
+} // namespace Bpvp